@@ -0,0 +1,260 @@
+// Copyright (c) 2025 Elric Neumann. All rights reserved. MIT license.
+//
+// type checker stress benchmark, generates a deterministic corpus of programs
+// per family at doubling sizes and runs only type_visitor over each of them
+// (best of --repeat runs). the growth column is log2 of the time ratio between
+// consecutive sizes, so linear passes sit around 1.0 and quadratic ones
+// around 2.0
+
+#define TYPED_LISP_NO_MAIN
+#include "../main.cc"
+
+#include <new>
+
+static uint64_t allocation_count = 0;
+static uint64_t allocation_bytes = 0;
+
+void* operator new(std::size_t size) {
+  allocation_count++;
+  allocation_bytes += size;
+
+  if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+
+  throw std::bad_alloc();
+}
+
+// the sized delete goes through the unsized one, which is kept out of line so
+// that the compiler does not see free() paired with a new expression
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { ::operator delete(ptr); }
+
+namespace typed_lisp::bench {
+
+// (def f0 ...) (def f1 ... (f0 x)) ... followed by (fn-1 (fn-2 ... (f0 0))),
+// so the expression goes through every def of the chain
+
+std::string gen_call_chain(size_t n) {
+  std::ostringstream oss;
+  oss << "(program\n";
+  oss << "  (def f0 : int (x : int) (+ x 1))\n";
+
+  for (size_t i = 1; i < n; ++i) {
+    oss << "  (def f" << i << " : int (x : int) (f" << i - 1 << " x))\n";
+  }
+
+  oss << "  ";
+  for (size_t i = n; i-- > 0;) oss << "(f" << i << " ";
+  oss << "0";
+  for (size_t i = 0; i < n; ++i) oss << ")";
+  oss << ")\n";
+
+  return oss.str();
+}
+
+// n / 8 polymorphic identities, each instantiated at 8 call sites
+
+std::string gen_polymorphic(size_t n) {
+  std::ostringstream oss;
+  size_t defs = std::max<size_t>(1, n / 8);
+  oss << "(program\n";
+
+  for (size_t i = 0; i < defs; ++i) {
+    oss << "  (def id" << i << " : 'a (x : 'a) x)\n";
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    oss << "  (id" << i % defs << " " << (i % 2 ? "false" : "7") << ")\n";
+  }
+
+  oss << ")\n";
+
+  return oss.str();
+}
+
+std::string gen_nested_ifs(size_t n) {
+  std::ostringstream oss;
+  oss << "(def deep : int (x : int)\n  ";
+
+  for (size_t i = 0; i < n; ++i) {
+    oss << "(if (> x " << i << ") ";
+  }
+
+  oss << "x";
+  for (size_t i = 0; i < n; ++i) oss << " 0)";
+  oss << ")\n";
+
+  return oss.str();
+}
+
+std::string gen_wide_args(size_t n) {
+  std::ostringstream oss;
+  oss << "(program\n  (def wide : int (";
+
+  for (size_t i = 0; i < n; ++i) {
+    oss << (i ? " " : "") << "a" << i << " : int";
+  }
+
+  oss << ") a0)\n  (wide";
+  for (size_t i = 0; i < n; ++i) oss << " " << i;
+  oss << "))\n";
+
+  return oss.str();
+}
+
+// every form is ill-typed, exercising the error reporting path
+
+std::string gen_type_errors(size_t n) {
+  std::ostringstream oss;
+  oss << "(program\n";
+
+  for (size_t i = 0; i < n; ++i) {
+    if (i % 2) {
+      oss << "  (+ " << i << " \"s\")\n";
+    } else {
+      oss << "  (if " << i << " 1 0)\n";
+    }
+  }
+
+  oss << ")\n";
+
+  return oss.str();
+}
+
+struct family {
+  const char* name;
+  std::string (*generate)(size_t);
+};
+
+const family families[] = {
+    {"call-chain", gen_call_chain},   {"polymorphic", gen_polymorphic},
+    {"nested-ifs", gen_nested_ifs},   {"wide-args", gen_wide_args},
+    {"type-errors", gen_type_errors},
+};
+
+struct sample {
+  double ms = 0;
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  uint64_t unify_calls = 0;
+  uint64_t unify_max_depth = 0;
+  size_t errors = 0;
+};
+
+sample run_type_visitor(const std::string& program) {
+  lisp_parser parser(program);
+  std::shared_ptr<node> ast = parser.parse();
+
+  compiler_context ctx;
+  type_visitor visitor(parser, ctx);
+  sample result;
+
+  uint64_t count_before = allocation_count;
+  uint64_t bytes_before = allocation_bytes;
+  auto start = std::chrono::steady_clock::now();
+
+  try {
+    ast->accept(&visitor);
+  } catch (const std::exception& e) {
+    result.errors++;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  result.ms = elapsed.count();
+  result.allocations = allocation_count - count_before;
+  result.bytes = allocation_bytes - bytes_before;
+  result.unify_calls = ctx.stats.unify_calls;
+  result.unify_max_depth = ctx.stats.unify_max_depth;
+  result.errors += visitor.get_errors().size();
+
+  return result;
+}
+
+}  // namespace typed_lisp::bench
+
+int main(int argc, char** argv) {
+  using namespace typed_lisp::bench;
+
+  size_t base = 250;
+  size_t steps = 4;
+  size_t repeat = 3;
+  std::string corpus_dir;
+  std::string only;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+
+    if (arg == "--emit-corpus" && i + 1 < argc) {
+      corpus_dir = argv[++i];
+    } else if (arg == "--base" && i + 1 < argc) {
+      base = std::stoul(argv[++i]);
+    } else if (arg == "--steps" && i + 1 < argc) {
+      steps = std::stoul(argv[++i]);
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max<size_t>(1, std::stoul(argv[++i]));
+    } else if (arg == "--family" && i + 1 < argc) {
+      only = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--base n] [--steps n] [--repeat n] [--family name]"
+                   " [--emit-corpus dir]\n";
+      return 1;
+    }
+  }
+
+  std::cout << std::left << std::setw(13) << "family" << std::right
+            << std::setw(7) << "n" << std::setw(11) << "ms" << std::setw(8)
+            << "growth" << std::setw(12) << "allocs" << std::setw(12) << "KiB"
+            << std::setw(10) << "unify" << std::setw(7) << "depth"
+            << std::setw(8) << "errors" << "\n";
+
+  for (const auto& fam : families) {
+    if (!only.empty() && only != fam.name) continue;
+
+    double previous_ms = 0;
+
+    for (size_t step = 0, n = base; step < steps; ++step, n *= 2) {
+      std::string program = fam.generate(n);
+
+      if (!corpus_dir.empty()) {
+        std::string path =
+            corpus_dir + "/" + fam.name + "-" + std::to_string(n) + ".lsp";
+        std::ofstream out(path);
+        out << program;
+        out.close();
+
+        // a failed open, write or flush all leave the stream failed
+        if (!out) {
+          std::cerr << "cannot write " << path << "\n";
+          return 1;
+        }
+      }
+
+      sample s = run_type_visitor(program);
+
+      for (size_t r = 1; r < repeat; ++r) {
+        s.ms = std::min(s.ms, run_type_visitor(program).ms);
+      }
+
+      std::cout << std::left << std::setw(13) << fam.name << std::right
+                << std::setw(7) << n << std::setw(11) << std::fixed
+                << std::setprecision(2) << s.ms << std::setw(8);
+
+      if (step && previous_ms > 0 && s.ms > 0) {
+        std::cout << std::setprecision(2) << std::log2(s.ms / previous_ms);
+      } else {
+        std::cout << "-";
+      }
+
+      std::cout << std::setw(12) << s.allocations << std::setw(12)
+                << s.bytes / 1024 << std::setw(10) << s.unify_calls
+                << std::setw(7) << s.unify_max_depth << std::setw(8)
+                << s.errors << "\n";
+
+      previous_ms = s.ms;
+    }
+  }
+
+  return 0;
+}
@@ -1,40 +1,60 @@
 // Copyright (c) 2025 Elric Neumann. All rights reserved. MIT license.
+#include "runtime/event_loop.h"
+#include "runtime/parallel.h"
+
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
-#include <llvm/Bitcode/BitcodeWriter.h> /*!*/
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassTimingInfo.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/CodeGen.h>
 #include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
+#include <limits>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <memory>
 #include <optional>
 #include <set>
@@ -43,7 +63,9 @@
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -57,6 +79,32 @@ namespace typed_lisp {
 #define TOKEN_SET "set"
 #define TOKEN_IF "if"
 #define TOKEN_DEF "def"
+#define TOKEN_WHILE "while"
+#define TOKEN_FOR "for"
+#define TOKEN_PARALLEL_FOR "parallel-for"
+#define TOKEN_PARALLEL_MAP "parallel-map"
+#define TOKEN_AWAIT "await"
+#define TOKEN_SLEEP "sleep"
+#define TOKEN_MAKE_ARRAY "make-array"
+#define TOKEN_ARRAY_GET "array-get"
+#define TOKEN_ARRAY_SET "array-set"
+#define TOKEN_ARRAY_LEN "array-len"
+#define TOKEN_STRUCT "struct"
+#define TOKEN_NEW "new"
+#define TOKEN_FIELD "field"
+#define TOKEN_WITH "with"
+#define TOKEN_SOA "soa"
+#define TOKEN_CAST "cast"
+#define TOKEN_SPLAT "splat"
+#define TOKEN_LANE "lane"
+#define TOKEN_WITH_LANE "with-lane"
+#define TOKEN_SHUFFLE "shuffle"
+#define TOKEN_REDUCE_ADD "reduce-add"
+#define TOKEN_REDUCE_MUL "reduce-mul"
+#define TOKEN_REDUCE_MIN "reduce-min"
+#define TOKEN_REDUCE_MAX "reduce-max"
+#define TOKEN_LOAD_VEC "load-vec"
+#define TOKEN_STORE_VEC "store-vec"
 #define TOKEN_COLON ":"
 #define TOKEN_QUOTE '"'
 #define TOKEN_LPAREN '('
@@ -71,6 +119,8 @@ namespace typed_lisp {
 #define TOKEN_GT ">"
 #define TOKEN_LEQ "<="
 #define TOKEN_GEQ ">="
+#define TOKEN_AND "and"
+#define TOKEN_OR "or"
 
 #define TYPE_INT "int"
 #define TYPE_BOOL "bool"
@@ -111,13 +161,10 @@ class node_visitor {
 
 void atom::accept(node_visitor* visitor) { visitor->visit(this); }
 
-void list::accept(node_visitor* visitor) {
-  visitor->visit(this);
+// visitors descend into the children they care about themselves, visiting
+// them here as well would revisit every subtree once per enclosing list
 
-  for (auto& child : children) {
-    child->accept(visitor);
-  }
-}
+void list::accept(node_visitor* visitor) { visitor->visit(this); }
 
 class lisp_parser {
  private:
@@ -207,10 +254,27 @@ class lisp_parser {
  public:
   explicit lisp_parser(std::string input_str) : input(std::move(input_str)) {}
 
+  // several top-level forms are wrapped in an implicit (program ...)
   std::shared_ptr<node> parse() {
     current_pos = 0;
 
-    return parse_expression();
+    auto first = parse_expression();
+    skip_whitespace();
+
+    if (current_pos >= input.length()) {
+      return first;
+    }
+
+    auto program = std::make_shared<list>();
+    program->children.push_back(std::make_shared<atom>(TOKEN_PROGRAM));
+    program->children.push_back(first);
+
+    while (current_pos < input.length()) {
+      program->children.push_back(parse_expression());
+      skip_whitespace();
+    }
+
+    return program;
   }
 
   std::pair<size_t, size_t> get_current_location() const {
@@ -224,7 +288,7 @@ class lisp_parser {
 
 std::string format_error(const std::string& message, size_t line, size_t column,
                          const std::string& context,
-                         const std::string& type_repr,
+                         [[maybe_unused]] const std::string& type_repr,
                          const std::string& hint) {
   std::ostringstream oss;
 
@@ -265,20 +329,162 @@ class tokens_print_visitor : public node_visitor {
   void visit(list* node) override {
     std::cout << "\nsize: " << node->children.size() << std::endl;
     // std::cout << "( ";
+
+    for (auto& child : node->children) {
+      child->accept(this);
+    }
   }
 };
 
 struct type;
 using type_ptr = std::shared_ptr<type>;
 
+// the final type of every expression, keyed by its node, handed from type
+// checking to lowering
+using node_type_map = std::unordered_map<const node*, type_ptr>;
+
+// counters and timers for the type checker, these are always collected since
+// the increments are negligible next to the allocations in unify/substitute
+
+struct type_stats {
+  // clang-format off
+  uint64_t unify_calls          = 0;
+  uint64_t unify_max_depth      = 0;
+  uint64_t fresh_vars           = 0;
+  uint64_t substitutions_max    = 0;
+  uint64_t instantiate_calls    = 0;
+  uint64_t lookups              = 0;
+  uint64_t lookup_chain_total   = 0;
+  uint64_t lookup_chain_max     = 0;
+  uint64_t unify_depth          = 0;
+  std::vector<std::pair<std::string, double>> def_times_us;
+  // clang-format on
+
+  void record_lookup(uint64_t chain_length) {
+    lookups++;
+    lookup_chain_total += chain_length;
+    lookup_chain_max = std::max(lookup_chain_max, chain_length);
+  }
+
+  // formatted into a local stream, so the caller's flags and precision are
+  // left alone
+  void print(std::ostream& out) const {
+    double avg_chain =
+        lookups ? static_cast<double>(lookup_chain_total) / lookups : 0.0;
+    std::ostringstream os;
+
+    os << "type checker stats:\n";
+    os << "  unify calls          " << unify_calls << "\n";
+    os << "  unify max depth      " << unify_max_depth << "\n";
+    os << "  fresh vars           " << fresh_vars << "\n";
+    os << "  substitutions (max)  " << substitutions_max << "\n";
+    os << "  instantiations       " << instantiate_calls << "\n";
+    os << "  scope lookups        " << lookups << "\n";
+    os << "  lookup chain (avg)   " << std::fixed << std::setprecision(2)
+       << avg_chain << "\n";
+    os << "  lookup chain (max)   " << lookup_chain_max << "\n";
+
+    for (const auto& [name, us] : def_times_us) {
+      os << "  def " << std::left << std::setw(17) << name << std::right
+         << std::fixed << std::setprecision(1) << us << " us\n";
+    }
+
+    out << os.str();
+  }
+
+  // strings are written as json string literals, the input path comes from
+  // the command line and may hold anything
+  static void write_json_string(std::ostream& os, const std::string& s) {
+    os << '"';
+
+    for (unsigned char c : s) {
+      switch (c) {
+        case '"':
+          os << "\\\"";
+          break;
+        case '\\':
+          os << "\\\\";
+          break;
+        case '\n':
+          os << "\\n";
+          break;
+        case '\r':
+          os << "\\r";
+          break;
+        case '\t':
+          os << "\\t";
+          break;
+        default:
+          if (c < 0x20) {
+            char escaped[7];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            os << escaped;
+          } else {
+            os << c;
+          }
+      }
+    }
+
+    os << '"';
+  }
+
+  // one key per line so that dumps from two releases diff cleanly
+
+  void print_json(std::ostream& out, const std::string& input) const {
+    std::ostringstream os;
+
+    os << "{\n";
+    os << "  \"input\": ";
+    write_json_string(os, input);
+    os << ",\n";
+    os << "  \"unify_calls\": " << unify_calls << ",\n";
+    os << "  \"unify_max_depth\": " << unify_max_depth << ",\n";
+    os << "  \"fresh_vars\": " << fresh_vars << ",\n";
+    os << "  \"substitutions_max\": " << substitutions_max << ",\n";
+    os << "  \"instantiate_calls\": " << instantiate_calls << ",\n";
+    os << "  \"lookups\": " << lookups << ",\n";
+    os << "  \"lookup_chain_total\": " << lookup_chain_total << ",\n";
+    os << "  \"lookup_chain_max\": " << lookup_chain_max << ",\n";
+    os << "  \"def_times_us\": [";
+
+    for (size_t i = 0; i < def_times_us.size(); ++i) {
+      os << (i ? ",\n" : "\n") << "    {\"name\": ";
+      write_json_string(os, def_times_us[i].first);
+      os << ", \"us\": " << std::fixed << std::setprecision(1)
+         << def_times_us[i].second << "}";
+    }
+
+    os << (def_times_us.empty() ? "]\n" : "\n  ]\n");
+    os << "}\n";
+
+    out << os.str();
+  }
+};
+
+// all mutable state of a single compilation lives here, nothing in the
+// compiler is static so compilations that each own a context can run
+// concurrently on separate threads
+
+class compiler_context {
+ public:
+  // clang-format off
+  int                                next_type_var_id = 0;
+  type_stats                         stats;
+  std::unique_ptr<llvm::LLVMContext> llvm_context;
+  std::unordered_map<std::string, type_ptr> named_types;
+  // clang-format on
+
+  compiler_context() : llvm_context(std::make_unique<llvm::LLVMContext>()) {}
+
+  compiler_context(const compiler_context&) = delete;
+  compiler_context& operator=(const compiler_context&) = delete;
+};
+
 struct type_var {
-  static int next_id;
   int id;
-  type_var() : id(next_id++) {}
+  explicit type_var(compiler_context& ctx) : id(ctx.next_type_var_id++) {}
 };
 
-int type_var::next_id = 0;
-
 struct type {
   virtual ~type() = default;
   virtual std::string to_string() const = 0;
@@ -295,7 +501,7 @@ struct atomic_type : type {
   std::string to_string() const override { return name; }
 
   type_ptr substitute(
-      const std::unordered_map<int, type_ptr>& subst) const override {
+      const std::unordered_map<int, type_ptr>&) const override {
     return std::make_shared<atomic_type>(*this);
   }
 
@@ -347,12 +553,280 @@ struct func_type : type {
   }
 };
 
+// `T[]` is an array whose length is only known at run time, `T[N]` one that
+// is declared to hold exactly N elements, which may be none
+
+struct array_type : type {
+  static constexpr size_t dynamic = std::numeric_limits<size_t>::max();
+
+  type_ptr elem_type;
+  size_t size;
+
+  array_type(type_ptr elem, size_t n) : elem_type(std::move(elem)), size(n) {}
+
+  bool is_dynamic() const { return size == dynamic; }
+
+  std::string to_string() const override {
+    return elem_type->to_string() + "[" +
+           (is_dynamic() ? "" : std::to_string(size)) + "]";
+  }
+
+  type_ptr substitute(
+      const std::unordered_map<int, type_ptr>& subst) const override {
+    return std::make_shared<array_type>(elem_type->substitute(subst), size);
+  }
+
+  std::vector<int> free_vars() const override { return elem_type->free_vars(); }
+};
+
+// a fixed width simd vector named vec<lanes><elem>, e.g. vec4f, vec2d, vec8i
+// or vec16u8, where f, d and i stand for float, double and int
+
+struct vector_type : type {
+  type_ptr elem_type;
+  size_t lanes;
+
+  vector_type(type_ptr elem, size_t n) : elem_type(std::move(elem)), lanes(n) {}
+
+  std::string to_string() const override {
+    std::string elem = elem_type->to_string();
+
+    if (elem == TYPE_FLOAT) elem = "f";
+    if (elem == TYPE_DOUBLE) elem = "d";
+    if (elem == TYPE_INT) elem = "i";
+
+    return "vec" + std::to_string(lanes) + elem;
+  }
+
+  type_ptr substitute(
+      const std::unordered_map<int, type_ptr>&) const override {
+    return std::make_shared<vector_type>(*this);
+  }
+
+  std::vector<int> free_vars() const override { return {}; }
+};
+
+// the result of calling a def declared to return async<T>, a suspended
+// computation that produces a T once awaited
+
+struct async_type : type {
+  type_ptr value_type;
+
+  explicit async_type(type_ptr value) : value_type(std::move(value)) {}
+
+  std::string to_string() const override {
+    return "async<" + value_type->to_string() + ">";
+  }
+
+  type_ptr substitute(
+      const std::unordered_map<int, type_ptr>& subst) const override {
+    return std::make_shared<async_type>(value_type->substitute(subst));
+  }
+
+  std::vector<int> free_vars() const override {
+    return value_type->free_vars();
+  }
+};
+
+// a record declared with (struct name (field : type ...)), records are
+// compared by name. arrays of a record declared with `soa` keep one array per
+// field instead of one array of records
+
+struct struct_type : type {
+  std::string name;
+  std::vector<std::pair<std::string, type_ptr>> fields;
+  bool soa = false;
+
+  std::string to_string() const override { return name; }
+
+  type_ptr substitute(
+      const std::unordered_map<int, type_ptr>&) const override {
+    return std::make_shared<struct_type>(*this);
+  }
+
+  std::vector<int> free_vars() const override { return {}; }
+
+  std::optional<size_t> field_index(const std::string& field) const {
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i].first == field) return i;
+    }
+
+    return std::nullopt;
+  }
+};
+
+// the sized integer types i8 to i64 and u8 to u64, int is i32
+struct integer_info {
+  unsigned bits;
+  bool is_signed;
+};
+
+std::optional<integer_info> integer_type_info(const std::string& name) {
+  if (name == TYPE_INT) return integer_info{32, true};
+
+  if (name.size() < 2 || (name[0] != 'i' && name[0] != 'u')) {
+    return std::nullopt;
+  }
+
+  for (unsigned bits : {8, 16, 32, 64}) {
+    if (name.compare(1, std::string::npos, std::to_string(bits)) == 0) {
+      return integer_info{bits, name[0] == 'i'};
+    }
+  }
+
+  return std::nullopt;
+}
+
+// a size spelled in a type annotation, array lengths are i32 at run time
+size_t parse_type_size(const std::string& digits, const std::string& name) {
+  if (digits.size() > 10 ||
+      std::stoull(digits) > size_t(std::numeric_limits<int32_t>::max())) {
+    throw std::runtime_error("sizes must fit in an i32, found " + name);
+  }
+
+  return std::stoul(digits);
+}
+
+// the type named by an annotation, e.g. int, int[4], vec4f, async<int> or a
+// declared record
+type_ptr parse_type(
+    const std::string& name,
+    const std::unordered_map<std::string, type_ptr>* named = nullptr) {
+  auto open = name.rfind('[');
+
+  if (open != std::string::npos && open > 0 && name.back() == ']') {
+    std::string size = name.substr(open + 1, name.size() - open - 2);
+
+    if (std::all_of(size.begin(), size.end(), ::isdigit)) {
+      return std::make_shared<array_type>(
+          parse_type(name.substr(0, open), named),
+          size.empty() ? array_type::dynamic : parse_type_size(size, name));
+    }
+  }
+
+  if (named) {
+    auto it = named->find(name);
+    if (it != named->end()) return it->second;
+  }
+
+  if (name.rfind("async<", 0) == 0 && name.back() == '>') {
+    return std::make_shared<async_type>(
+        parse_type(name.substr(6, name.size() - 7), named));
+  }
+
+  if (name.rfind("vec", 0) == 0) {
+    size_t suffix = name.find_first_not_of("0123456789", 3);
+
+    if (suffix != 3 && suffix != std::string::npos) {
+      std::string elem = name.substr(suffix);
+      size_t lanes = parse_type_size(name.substr(3, suffix - 3), name);
+
+      if (elem == "f") elem = TYPE_FLOAT;
+      if (elem == "d") elem = TYPE_DOUBLE;
+      if (elem == "i") elem = TYPE_INT;
+
+      if (lanes >= 2 && (elem == TYPE_FLOAT || elem == TYPE_DOUBLE ||
+                         integer_type_info(elem))) {
+        return std::make_shared<vector_type>(parse_type(elem), lanes);
+      }
+    }
+  }
+
+  return std::make_shared<atomic_type>(name == "i32" ? TYPE_INT : name);
+}
+
+// float literals carry a decimal point or an exponent, an `f` suffix makes
+// them single precision, e.g. 1.5, 2e3, 0.5f
+bool is_float_literal(const std::string& value) {
+  if (value.empty() || value.find_first_of(".eE") == std::string::npos ||
+      value.find_first_of("xX") != std::string::npos) {
+    return false;
+  }
+
+  std::string digits = value.back() == 'f' ? value.substr(0, value.size() - 1)
+                                           : value;
+
+  if (digits.empty() || !(::isdigit(digits[0]) || digits[0] == '-' ||
+                          digits[0] == '.')) {
+    return false;
+  }
+
+  char* end = nullptr;
+  std::strtod(digits.c_str(), &end);
+
+  return end == digits.c_str() + digits.size();
+}
+
+std::optional<integer_info> integer_type_info(const type_ptr& t) {
+  auto atomic = std::dynamic_pointer_cast<atomic_type>(t);
+
+  return atomic ? integer_type_info(atomic->name) : std::nullopt;
+}
+
+// integer literals are int unless suffixed with a sized type, e.g. 42i64 or
+// 255u8, returns the suffix and leaves the digits in `digits`
+std::optional<std::string> integer_literal_type(const std::string& value,
+                                                std::string* digits = nullptr) {
+  auto suffix = value.find_first_of("iu");
+
+  if (suffix == std::string::npos || suffix == 0 ||
+      !integer_type_info(value.substr(suffix))) {
+    return std::nullopt;
+  }
+
+  size_t first = value[0] == '-' ? 1 : 0;
+
+  if (first == suffix || !std::all_of(value.begin() + first,
+                                      value.begin() + suffix, ::isdigit)) {
+    return std::nullopt;
+  }
+
+  if (digits) *digits = value.substr(0, suffix);
+
+  return value.substr(suffix);
+}
+
+bool is_numeric_type(const type_ptr& t) {
+  auto atomic = std::dynamic_pointer_cast<atomic_type>(t);
+
+  return atomic && (integer_type_info(atomic->name) ||
+                    atomic->name == TYPE_FLOAT || atomic->name == TYPE_DOUBLE);
+}
+
+bool is_arithmetic_op(const std::string& name) {
+  return name == TOKEN_ADD || name == TOKEN_SUB || name == TOKEN_MUL ||
+         name == TOKEN_DIV;
+}
+
+bool is_vector_op(const std::string& name) {
+  return name == TOKEN_SPLAT || name == TOKEN_LANE || name == TOKEN_WITH_LANE ||
+         name == TOKEN_SHUFFLE || name == TOKEN_REDUCE_ADD ||
+         name == TOKEN_REDUCE_MUL || name == TOKEN_REDUCE_MIN ||
+         name == TOKEN_REDUCE_MAX || name == TOKEN_LOAD_VEC ||
+         name == TOKEN_STORE_VEC;
+}
+
+bool is_numeric_op(const std::string& name) {
+  return name == TOKEN_ADD || name == TOKEN_SUB || name == TOKEN_MUL ||
+         name == TOKEN_DIV || name == TOKEN_EQ || name == TOKEN_NEQ ||
+         name == TOKEN_LT || name == TOKEN_GT || name == TOKEN_LEQ ||
+         name == TOKEN_GEQ;
+}
+
 class type_env {
   std::unordered_map<std::string, type_ptr> env;
 
  public:
   void insert(const std::string& name, type_ptr t) { env[name] = std::move(t); }
 
+  void clear() { env.clear(); }
+  bool empty() const { return env.empty(); }
+
+  bool contains(const std::string& name) const { return env.count(name); }
+
+  auto begin() const { return env.begin(); }
+  auto end() const { return env.end(); }
+
   type_ptr lookup(const std::string& name) const {
     auto it = env.find(name);
 
@@ -363,6 +837,7 @@ class type_env {
 };
 
 class type_system {
+  compiler_context* ctx;
   std::unordered_map<int, type_ptr> substitutions;
 
   bool occurs_check(int var_id, const type_ptr& t) {
@@ -376,12 +851,36 @@ class type_system {
   }
 
  public:
+  explicit type_system(compiler_context& c) : ctx(&c) {}
+
   void unify(type_ptr t1, type_ptr t2) {
+    auto& stats = ctx->stats;
+    stats.unify_calls++;
+    stats.unify_depth++;
+    stats.unify_max_depth = std::max(stats.unify_max_depth, stats.unify_depth);
+
+    try {
+      unify_impl(std::move(t1), std::move(t2));
+    } catch (...) {
+      stats.unify_depth--;
+      throw;
+    }
+
+    stats.unify_depth--;
+    stats.substitutions_max =
+        std::max<uint64_t>(stats.substitutions_max, substitutions.size());
+  }
+
+ private:
+  void unify_impl(type_ptr t1, type_ptr t2) {
     t1 = apply_substitution(t1);
     t2 = apply_substitution(t2);
 
     if (auto v1 = std::dynamic_pointer_cast<var_type>(t1)) {
-      if (t1 != t2) {
+      // substitution copies types, so a variable is compared by id
+      auto v2 = std::dynamic_pointer_cast<var_type>(t2);
+
+      if (!v2 || v2->id != v1->id) {
         if (occurs_check(v1->id, t2)) {
           throw std::runtime_error("recursive unification");
         }
@@ -406,6 +905,38 @@ class type_system {
       return;
     }
 
+    auto r1 = std::dynamic_pointer_cast<array_type>(t1);
+    auto r2 = std::dynamic_pointer_cast<array_type>(t2);
+
+    // an array of unknown length unifies with any length
+    if (r1 && r2 &&
+        (r1->is_dynamic() || r2->is_dynamic() || r1->size == r2->size)) {
+      unify(r1->elem_type, r2->elem_type);
+      return;
+    }
+
+    auto c1 = std::dynamic_pointer_cast<async_type>(t1);
+    auto c2 = std::dynamic_pointer_cast<async_type>(t2);
+
+    if (c1 && c2) {
+      unify(c1->value_type, c2->value_type);
+      return;
+    }
+
+    auto v1 = std::dynamic_pointer_cast<vector_type>(t1);
+    auto v2 = std::dynamic_pointer_cast<vector_type>(t2);
+
+    if (v1 && v2 && v1->to_string() == v2->to_string()) {
+      return;
+    }
+
+    auto s1 = std::dynamic_pointer_cast<struct_type>(t1);
+    auto s2 = std::dynamic_pointer_cast<struct_type>(t2);
+
+    if (s1 && s2 && s1->name == s2->name) {
+      return;
+    }
+
     auto a1 = std::dynamic_pointer_cast<atomic_type>(t1);
     auto a2 = std::dynamic_pointer_cast<atomic_type>(t2);
 
@@ -417,64 +948,143 @@ class type_system {
                              " but found " + t2->to_string());
   }
 
-  type_ptr fresh_var() { return std::make_shared<var_type>(type_var().id); }
+ public:
+  type_ptr fresh_var() {
+    ctx->stats.fresh_vars++;
+    return std::make_shared<var_type>(type_var(*ctx).id);
+  }
 
   type_ptr get_type(const std::string& name) {
-    return std::make_shared<atomic_type>(name);
+    return parse_type(name, &ctx->named_types);
+  }
+
+  type_ptr make_array_type(type_ptr elem) {
+    return std::make_shared<array_type>(std::move(elem), array_type::dynamic);
   }
 
   type_ptr make_function_type(type_ptr arg, type_ptr ret) {
     return std::make_shared<func_type>(std::move(arg), std::move(ret));
   }
 
-  type_ptr get_final_type(const type_ptr& t) { return apply_substitution(t); }
+  // a binding may point at a variable that was bound later, so substitution
+  // is repeated until no bound variable is left
+  type_ptr get_final_type(const type_ptr& t) {
+    type_ptr result = apply_substitution(t);
+
+    for (size_t i = 0; i < substitutions.size(); ++i) {
+      auto vars = result->free_vars();
+      bool bound = std::any_of(vars.begin(), vars.end(), [&](int var) {
+        return substitutions.count(var) != 0;
+      });
+
+      if (!bound) break;
+      result = apply_substitution(result);
+    }
+
+    return result;
+  }
+
+  void clear() { substitutions.clear(); }
 };
 
-class scope : public std::enable_shared_from_this<scope> {
+// scopes follow lexical nesting, a child never outlives its parent so the
+// parent link is non-owning and nothing keeps a finished scope alive. block
+// scopes (if branches, loop bodies) only limit where bindings are visible,
+// they share their parent's substitutions so nothing unified there is lost
+
+class scope {
   // clang-format off
-  std::shared_ptr<scope>                            parent;
-  std::vector<std::shared_ptr<scope>>               children;
+  compiler_context*                                 ctx;
+  scope*                                            parent;
   type_env                                          env;
   type_system                                       types;
   std::unordered_map<std::string, std::vector<int>> polymorphic_vars;
+  type_system*                                      shared_types;
+  scope*                                            outer;
+  std::unordered_set<std::string>                   read_only;
   // clang-format on
 
- public:
-  explicit scope(std::shared_ptr<scope> p = nullptr) : parent(p) {}
+  // enclosing scopes gain no bindings while a scope nested in them is open,
+  // so lookups skip over blocks that are still empty
+  void link(scope* p, bool block) {
+    parent = p;
+    shared_types = block ? &p->get_type_system() : &types;
+    outer = block && p->is_empty_block() ? p->outer : p;
+  }
 
-  void add_child(std::shared_ptr<scope> child) { children.push_back(child); }
+  bool is_empty_block() const { return shared_types != &types && env.empty(); }
 
-  std::shared_ptr<scope> create_child() {
-    auto child = std::make_shared<scope>(shared_from_this());
-    add_child(child);
-    return child;
+ public:
+  explicit scope(compiler_context& c, scope* p = nullptr, bool block = false)
+      : ctx(&c), types(c) {
+    link(p, block);
   }
 
-  type_ptr lookup_type(const std::string& name) {
-    try {
-      auto t = env.lookup(name);
+  // drops all bindings but keeps the allocated buckets for the next user
+  void reset(scope* p, bool block) {
+    env.clear();
+    read_only.clear();
+    types.clear();
+    polymorphic_vars.clear();
+    link(p, block);
+  }
 
-      if (auto poly_vars = get_polymorphic_vars(name)) {
-        return instantiate_polymorphic_type(t, *poly_vars);
-      }
+  // names missing here go to the enclosing scope without throwing, only the
+  // outermost scope reports an unbound name
+  type_ptr lookup_type(const std::string& name, uint64_t depth = 1) {
+    if (outer && !env.contains(name)) {
+      return outer->lookup_type(name, depth + 1);
+    }
 
-      return t;
-    } catch (const std::runtime_error& e) {
-      if (parent) return parent->lookup_type(name);
-      std::cout << "=== lookup issue here===\n";
-      throw std::runtime_error(e.what());  // ??
+    ctx->stats.record_lookup(depth);
+    auto t = env.lookup(name);
+
+    if (auto poly_vars = get_polymorphic_vars(name)) {
+      return instantiate_polymorphic_type(t, *poly_vars);
     }
+
+    return t;
   }
 
   void define_type(const std::string& name, type_ptr t,
                    const std::vector<int>& poly_vars = {}) {
     env.insert(name, t);
+    read_only.erase(name);
 
     if (!poly_vars.empty()) {
       polymorphic_vars[name] = poly_vars;
     }
   }
 
+  // loop indices are the loop's induction variable, set cannot change them
+  void define_read_only(const std::string& name, type_ptr t) {
+    define_type(name, std::move(t));
+    read_only.insert(name);
+  }
+
+  bool defines(const std::string& name) const { return env.contains(name); }
+
+  // whether the binding the name resolves to from here is read only
+  bool is_read_only(const std::string& name) const {
+    if (outer && !env.contains(name)) return outer->is_read_only(name);
+    return read_only.count(name) != 0;
+  }
+
+  // the type variables a def declared below this scope must not generalize,
+  // the variables of a polymorphic binding are its own and do not count
+  void collect_free_vars(std::unordered_set<int>& vars) {
+    for (const auto& [name, t] : env) {
+      auto poly_vars = get_polymorphic_vars(name);
+
+      for (int var : get_type_system().get_final_type(t)->free_vars()) {
+        if (!poly_vars || std::find(poly_vars->begin(), poly_vars->end(),
+                                    var) == poly_vars->end()) {
+          vars.insert(var);
+        }
+      }
+    }
+  }
+
   std::optional<std::vector<int>> get_polymorphic_vars(
       const std::string& name) {
     auto it = polymorphic_vars.find(name);
@@ -488,24 +1098,54 @@ class scope : public std::enable_shared_from_this<scope> {
 
   type_ptr instantiate_polymorphic_type(type_ptr t,
                                         const std::vector<int>& vars) {
+    ctx->stats.instantiate_calls++;
     std::unordered_map<int, type_ptr> subst;
 
     for (int var : vars) {
-      subst[var] = types.fresh_var();
+      subst[var] = get_type_system().fresh_var();
     }
 
     return t->substitute(subst);
   }
 
-  type_system& get_type_system() { return types; }
-  std::shared_ptr<scope> get_parent() { return parent; }
+  type_system& get_type_system() { return *shared_types; }
+
+  scope* get_parent() { return parent; }
+  scope* get_outer() { return outer; }
+};
+
+// recycles function and block scopes, acquire on entering a body and release
+// on leaving it, so at most one scope per nesting level is live during type
+// checking
+
+class scope_pool {
+  compiler_context* ctx;
+  std::vector<std::unique_ptr<scope>> free_list;
+
+ public:
+  explicit scope_pool(compiler_context& c) : ctx(&c) {}
+
+  std::unique_ptr<scope> acquire(scope* parent, bool block = false) {
+    if (free_list.empty()) return std::make_unique<scope>(*ctx, parent, block);
+
+    auto s = std::move(free_list.back());
+    free_list.pop_back();
+    s->reset(parent, block);
+
+    return s;
+  }
+
+  void release(std::unique_ptr<scope> s) { free_list.push_back(std::move(s)); }
 };
 
+void register_builtins(scope* scope);
+
 class type_visitor : public node_visitor,
                      public std::enable_shared_from_this<type_visitor> {
  public:
-  std::shared_ptr<scope> global_scope;
-  std::shared_ptr<scope> current_scope;
+  std::unique_ptr<scope> global_scope;
+  scope*                 current_scope;
+  scope_pool             scopes;
 
   struct var_binding {
     std::string name;
@@ -517,57 +1157,82 @@ class type_visitor : public node_visitor,
   // clang-format off
 
   bool entered_fn_block = false;
+  bool in_async = false;
+
+  // the block of the innermost parallel-for body, iterations run concurrently
+  // so variables bound outside of it cannot be assigned
+  scope* parallel_body = nullptr;
+
+  // the scope of the innermost def, defs are lowered to plain functions and
+  // cannot read the variables of an enclosing def
+  scope* def_scope = nullptr;
+
   std::unordered_map<std::string, var_binding> bindings;
   std::vector<std::string>                     errors;
   type_ptr                                     current_type;
   std::vector<std::shared_ptr<node>>           call_stack;
+  node_type_map                                node_types;
+
+  // node types recorded in each open scope, resolved against the scope's
+  // substitutions when it is released and handed to the enclosing scope
+  std::vector<std::vector<std::pair<const node*, type_ptr>>> open_types{1};
 
   // clang-format on
 
-  type_ptr infer_literal(const std::string& value) {
-    if (value == TOKEN_PROGRAM || value == TOKEN_FALSE)
-      return current_scope->get_type_system().get_type(TYPE_BOOL);
+  void record_type(const node* n) {
+    if (current_type) open_types.back().emplace_back(n, current_type);
+  }
 
+  static bool fits_integer(const std::string& digits, integer_info info) {
     try {
-      std::stoi(value);
-      return current_scope->get_type_system().get_type(TYPE_INT);
+      if (digits[0] == '-') {
+        if (!info.is_signed) return false;
+        int64_t value = std::stoll(digits);
+        return info.bits == 64 || value >= -(int64_t(1) << (info.bits - 1));
+      }
+
+      uint64_t value = std::stoull(digits);
+      unsigned bits = info.is_signed ? info.bits - 1 : info.bits;
+
+      return bits == 64 || value < (uint64_t(1) << bits);
     } catch (...) {
+      return false;
     }
+  }
 
-    if (value.front() == TOKEN_QUOTE && value.back() == TOKEN_QUOTE)
-      return current_scope->get_type_system().get_type(TYPE_STRING);
+  type_ptr infer_literal(const std::string& value) {
+    if (value == TOKEN_TRUE || value == TOKEN_FALSE)
+      return current_scope->get_type_system().get_type(TYPE_BOOL);
 
-    if (value.front() == TYPE_POLYMORPHIC_SPECIFIER) {
-      auto var = current_scope->get_type_system().fresh_var();
-      return var;
+    if (is_float_literal(value)) {
+      return current_scope->get_type_system().get_type(
+          value.back() == 'f' ? TYPE_FLOAT : TYPE_DOUBLE);
     }
 
-    return current_scope->lookup_type(value);
-  }
+    std::string digits;
+    if (auto suffix = integer_literal_type(value, &digits)) {
+      if (!fits_integer(digits, *integer_type_info(*suffix))) {
+        errors.push_back("integer literal out of range: " + value);
+      }
 
-  type_ptr infer_binary_op(const std::string& op, type_ptr lhs, type_ptr rhs) {
-    auto& ts = current_scope->get_type_system();
+      return current_scope->get_type_system().get_type(*suffix);
+    }
 
     try {
-      ts.unify(lhs, rhs);
-
-      if (op == TOKEN_ADD || op == TOKEN_SUB || op == TOKEN_MUL ||
-          op == TOKEN_DIV) {
-        auto int_t = ts.get_type(TYPE_INT);
-        ts.unify(lhs, int_t);
-        return int_t;
-      }
+      std::stoi(value);
+      return current_scope->get_type_system().get_type(TYPE_INT);
+    } catch (...) {
+    }
 
-      if (op == TOKEN_EQ || op == TOKEN_NEQ || op == TOKEN_LT ||
-          op == TOKEN_GT) {
-        return ts.get_type(TYPE_BOOL);
-      }
+    if (value.front() == TOKEN_QUOTE && value.back() == TOKEN_QUOTE)
+      return current_scope->get_type_system().get_type(TYPE_STRING);
 
-      throw std::runtime_error("unknown operator: " + op);
-    } catch (const std::runtime_error& e) {
-      errors.push_back(e.what());
-      return ts.fresh_var();
+    if (value.front() == TYPE_POLYMORPHIC_SPECIFIER) {
+      auto var = current_scope->get_type_system().fresh_var();
+      return var;
     }
+
+    return current_scope->lookup_type(value);
   }
 
   void visit_let(list* node) {
@@ -598,8 +1263,7 @@ class type_visitor : public node_visitor,
       poly_vars.push_back(std::dynamic_pointer_cast<var_type>(var)->id);
       declared_type = var;
     } else {
-      declared_type =
-          current_scope->get_type_system().get_type(type_node->value);
+      declared_type = parse_annotation(type_node->value);
     }
 
     value_node->accept(this);
@@ -618,6 +1282,18 @@ class type_visitor : public node_visitor,
 
       bindings[name_node->value] = {name_node->value, declared_type, value_node,
                                     poly_vars};
+
+      // a literal length is known here, any other length is checked when the
+      // binding runs
+      auto declared = std::dynamic_pointer_cast<array_type>(declared_type);
+      auto length = literal_length(value_node);
+
+      if (declared && !declared->is_dynamic() && length &&
+          size_t(*length) != declared->size) {
+        throw std::runtime_error("expected " + declared->to_string() +
+                                 " but found an array of length " +
+                                 std::to_string(*length));
+      }
     } catch (const std::runtime_error& e) {
       std::shared_ptr<typed_lisp::node> shared_node = node->shared_from_this();
       with_error("type error in let binding", shared_node, declared_type,
@@ -627,35 +1303,49 @@ class type_visitor : public node_visitor,
     }
   }
 
-  void visit_def(list* node) {
-    if (node->children.size() < 6) {
-      errors.push_back(
-          "malformed def expression, expected (def name : return_type (params) "
-          "body)");
-      return;
-    }
+  struct def_signature {
+    std::vector<std::pair<std::string, type_ptr>> params;
+    type_ptr ret_type;
+    type_ptr type;
+    std::vector<int> poly_vars;
+  };
 
-    auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
-    auto colon = std::dynamic_pointer_cast<atom>(node->children[2]);
+  // the parameters and return type of a def as annotated, and the curried
+  // type they make. Every mention of the same 'name is the same variable.
+  // Malformed parameters and types are reported when `report` is set,
+  // otherwise they throw
+  def_signature read_signature(list* node, bool report) {
+    auto& ts = current_scope->get_type_system();
     auto ret_type_node = std::dynamic_pointer_cast<atom>(node->children[3]);
     auto params = std::dynamic_pointer_cast<list>(node->children[4]);
 
-    if (!name_node || !colon || !ret_type_node || !params ||
-        colon->value != TOKEN_COLON) {
-      errors.push_back("malformed def expression");
-      return;
-    }
+    def_signature signature;
+    std::unordered_map<std::string, type_ptr> named_vars;
 
-    auto fn_scope = current_scope->create_child();
-    auto prev_scope = current_scope;
-    current_scope = fn_scope;
+    auto malformed = [&](const std::string& message) {
+      if (!report) throw std::runtime_error(message);
+      errors.push_back(message);
+    };
 
-    std::vector<type_ptr> param_types;
-    std::vector<int> poly_vars;
+    auto annotation_type = [&](const std::string& name) {
+      if (name.front() != TYPE_POLYMORPHIC_SPECIFIER) {
+        return report ? parse_annotation(name) : ts.get_type(name);
+      }
+
+      auto& var = named_vars[name];
+
+      if (!var) {
+        var = ts.fresh_var();
+        signature.poly_vars.push_back(
+            std::dynamic_pointer_cast<var_type>(var)->id);
+      }
+
+      return var;
+    };
 
     for (size_t i = 0; i < params->children.size(); i += 3) {
       if (i + 2 >= params->children.size()) {
-        errors.push_back("malformed parameter list");
+        malformed("malformed parameter list");
         continue;
       }
 
@@ -665,44 +1355,109 @@ class type_visitor : public node_visitor,
       auto param_type =
           std::dynamic_pointer_cast<atom>(params->children[i + 2]);
 
-      // std::cout << param_name->value << param_colon->value
-      // << param_type->value << "\n";
-
       if (!param_name || !param_colon || !param_type ||
           param_colon->value != TOKEN_COLON) {
-        errors.push_back("malformed parameter");
+        malformed("malformed parameter");
         continue;
       }
 
-      type_ptr param_t;
-      if (param_type->value.front() == TYPE_POLYMORPHIC_SPECIFIER) {
-        auto var = current_scope->get_type_system().fresh_var();
-        poly_vars.push_back(std::dynamic_pointer_cast<var_type>(var)->id);
-        param_t = var;
-      } else {
-        param_t = current_scope->get_type_system().get_type(param_type->value);
-      }
+      signature.params.emplace_back(param_name->value,
+                                    annotation_type(param_type->value));
+    }
 
-      current_scope->define_type(param_name->value, param_t);
-      param_types.push_back(param_t);
+    signature.ret_type = annotation_type(ret_type_node->value);
+    signature.type = signature.ret_type;
+
+    for (auto it = signature.params.rbegin(); it != signature.params.rend();
+         ++it) {
+      signature.type = ts.make_function_type(it->second, signature.type);
     }
 
-    type_ptr ret_t;
-    if (ret_type_node->value.front() == TYPE_POLYMORPHIC_SPECIFIER) {
-      auto var = current_scope->get_type_system().fresh_var();
-      poly_vars.push_back(std::dynamic_pointer_cast<var_type>(var)->id);
-      ret_t = var;
-    } else {
-      ret_t = current_scope->get_type_system().get_type(ret_type_node->value);
+    return signature;
+  }
+
+  // binds the annotated type of a top-level def before any body is checked,
+  // so defs can call each other in any order. visit_def binds it again once
+  // its body is checked and reports any problem with the signature
+  void declare_def(list* node) {
+    auto name_node = node->children.size() >= 6
+                         ? std::dynamic_pointer_cast<atom>(node->children[1])
+                         : nullptr;
+    auto colon = name_node ? std::dynamic_pointer_cast<atom>(node->children[2])
+                           : nullptr;
+
+    if (!colon || colon->value != TOKEN_COLON ||
+        !std::dynamic_pointer_cast<atom>(node->children[3]) ||
+        !std::dynamic_pointer_cast<list>(node->children[4])) {
+      return;
+    }
+
+    try {
+      auto signature = read_signature(node, false);
+      current_scope->define_type(name_node->value, signature.type,
+                                 signature.poly_vars);
+    } catch (const std::runtime_error&) {
+    }
+  }
+
+  void visit_def(list* node) {
+    if (node->children.size() < 6) {
+      errors.push_back(
+          "malformed def expression, expected (def name : return_type (params) "
+          "body)");
+      return;
+    }
+
+    auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+    auto colon = std::dynamic_pointer_cast<atom>(node->children[2]);
+    auto ret_type_node = std::dynamic_pointer_cast<atom>(node->children[3]);
+    auto params = std::dynamic_pointer_cast<list>(node->children[4]);
+
+    if (!name_node || !colon || !ret_type_node || !params ||
+        colon->value != TOKEN_COLON) {
+      errors.push_back("malformed def expression");
+      return;
+    }
+
+    bool top_level = current_scope == global_scope.get();
+    auto start = std::chrono::steady_clock::now();
+
+    auto fn_scope = scopes.acquire(current_scope);
+    auto prev_scope = current_scope;
+    auto prev_def_scope = def_scope;
+    current_scope = fn_scope.get();
+    def_scope = fn_scope.get();
+    open_types.emplace_back();
+
+    auto signature = read_signature(node, true);
+    std::vector<int> poly_vars = std::move(signature.poly_vars);
+    type_ptr fn_type = signature.type;
+    type_ptr ret_t = signature.ret_type;
+
+    for (const auto& [param_name, param_t] : signature.params) {
+      current_scope->define_type(param_name, param_t);
+    }
+
+    // an async def returns a handle to its body, which evaluates to the value
+    auto async = std::dynamic_pointer_cast<async_type>(ret_t);
+    bool prev_in_async = in_async;
+    in_async = async != nullptr;
+
+    if (async) {
+      ret_t = async->value_type;
     }
 
-    std::cout << "ret_t: " << ret_t->to_string() << "\n";
+    // recursive calls see the def at its declared, uninstantiated type
+    current_scope->define_type(name_node->value, fn_type);
 
-    auto body = node->children[5];
+    // the body is a sequence, the last form gives the return value
     entered_fn_block = true;
-    body->accept(this);
+    for (size_t i = 5; i < node->children.size(); ++i) {
+      node->children[i]->accept(this);
+    }
     auto body_type = current_type;
     entered_fn_block = false;
+    in_async = prev_in_async;
 
     try {
       current_scope->get_type_system().unify(ret_t, body_type);
@@ -710,14 +1465,85 @@ class type_visitor : public node_visitor,
       errors.push_back("return type mismatch: " + std::string(e.what()));
     }
 
-    type_ptr fn_type = ret_t;
-    for (auto it = param_types.rbegin(); it != param_types.rend(); ++it) {
-      fn_type =
-          current_scope->get_type_system().make_function_type(*it, fn_type);
+    auto& fn_types = fn_scope->get_type_system();
+    fn_type = fn_types.get_final_type(fn_type);
+
+    // calling another polymorphic def can leave its instantiated variables in
+    // the type instead of the 'a ids, those are generalized too unless an
+    // enclosing binding still refers to them
+    std::vector<int> open_vars;
+
+    for (int var : fn_type->free_vars()) {
+      if (std::find(poly_vars.begin(), poly_vars.end(), var) ==
+              poly_vars.end() &&
+          std::find(open_vars.begin(), open_vars.end(), var) ==
+              open_vars.end()) {
+        open_vars.push_back(var);
+      }
+    }
+
+    if (!open_vars.empty()) {
+      std::unordered_set<int> env_vars;
+
+      for (scope* s = prev_scope; s; s = s->get_outer()) {
+        s->collect_free_vars(env_vars);
+      }
+
+      for (int var : open_vars) {
+        if (!env_vars.count(var)) poly_vars.push_back(var);
+      }
+    }
+
+    auto body_types = std::move(open_types.back());
+    open_types.pop_back();
+
+    for (auto& [n, t] : body_types) {
+      open_types.back().emplace_back(n, fn_types.get_final_type(t));
     }
 
     current_scope = prev_scope;
+    def_scope = prev_def_scope;
     current_scope->define_type(name_node->value, fn_type, poly_vars);
+    scopes.release(std::move(fn_scope));
+    current_type = fn_type;
+
+    if (top_level) {
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ctx.stats.def_times_us.emplace_back(name_node->value, elapsed.count());
+    }
+  }
+
+  static bool is_form(const std::shared_ptr<node>& n, const std::string& op) {
+    auto l = std::dynamic_pointer_cast<list>(n);
+    auto head = l && !l->children.empty()
+                    ? std::dynamic_pointer_cast<atom>(l->children[0])
+                    : nullptr;
+
+    return head && head->value == op;
+  }
+
+  // structs are declared and then the signatures of defs bound before the
+  // rest of the program is checked, so top-level defs can be mutually
+  // recursive
+  void visit_program(list* node) {
+    for (size_t i = 1; i < node->children.size(); ++i) {
+      if (is_form(node->children[i], TOKEN_STRUCT)) {
+        node->children[i]->accept(this);
+      }
+    }
+
+    for (size_t i = 1; i < node->children.size(); ++i) {
+      if (is_form(node->children[i], TOKEN_DEF)) {
+        declare_def(static_cast<list*>(node->children[i].get()));
+      }
+    }
+
+    for (size_t i = 1; i < node->children.size(); ++i) {
+      if (!is_form(node->children[i], TOKEN_STRUCT)) {
+        node->children[i]->accept(this);
+      }
+    }
   }
 
   void visit_set(list* node) {
@@ -737,6 +1563,30 @@ class type_visitor : public node_visitor,
     value_node->accept(this);
     auto value_type = current_type;
 
+    if (current_scope->is_read_only(name_node->value)) {
+      with_error("cannot set a loop index", name_node, nullptr,
+                 "the index of a for loop is read-only: " + name_node->value);
+      return;
+    }
+
+    if (captures_enclosing_def(name_node->value)) {
+      with_error("cannot set a variable of an enclosing def", name_node,
+                 nullptr,
+                 "a def sees its own bindings, other defs and top-level "
+                 "bindings: " +
+                     name_node->value);
+      return;
+    }
+
+    if (parallel_body && !defined_since(name_node->value, parallel_body)) {
+      with_error("cannot set a variable captured by a parallel body",
+                 name_node, nullptr,
+                 "iterations run concurrently, write results into an array "
+                 "instead: " +
+                     name_node->value);
+      return;
+    }
+
     try {
       auto var_type = current_scope->lookup_type(name_node->value);
       current_scope->get_type_system().unify(var_type, value_type);
@@ -747,6 +1597,49 @@ class type_visitor : public node_visitor,
     }
   }
 
+  // whether the name resolves to a variable bound by a def enclosing the
+  // innermost one, other defs are plain functions and can be called
+  bool captures_enclosing_def(const std::string& name) {
+    bool inside = true;
+
+    for (scope* s = def_scope ? current_scope : nullptr; s;
+         s = s->get_parent()) {
+      if (s->defines(name)) {
+        if (inside || s == global_scope.get()) return false;
+
+        auto t = s->get_type_system().get_final_type(s->lookup_type(name));
+        return !std::dynamic_pointer_cast<func_type>(t);
+      }
+
+      if (s == def_scope) inside = false;
+    }
+
+    return false;
+  }
+
+  // whether the name is bound in `outer` or one of the scopes nested in it
+  bool defined_since(const std::string& name, scope* outer) {
+    for (scope* s = current_scope; s; s = s->get_parent()) {
+      if (s->defines(name)) return true;
+      if (s == outer) break;
+    }
+
+    return false;
+  }
+
+  // bindings in a block end with it, the same places codegen starts a new
+  // scope because a value defined there does not dominate what follows
+  std::unique_ptr<scope> enter_block() {
+    auto block = scopes.acquire(current_scope, true);
+    current_scope = block.get();
+    return block;
+  }
+
+  void leave_block(std::unique_ptr<scope> block) {
+    current_scope = block->get_parent();
+    scopes.release(std::move(block));
+  }
+
   void visit_if(list* node) {
     if (node->children.size() != 4) {
       errors.push_back("malformed if expression, expected (if cond then else)");
@@ -763,11 +1656,15 @@ class type_visitor : public node_visitor,
       errors.push_back("condition must be boolean: " + std::string(e.what()));
     }
 
+    auto block = enter_block();
     node->children[2]->accept(this);
     auto then_type = current_type;
+    leave_block(std::move(block));
 
+    block = enter_block();
     node->children[3]->accept(this);
     auto else_type = current_type;
+    leave_block(std::move(block));
 
     try {
       current_scope->get_type_system().unify(then_type, else_type);
@@ -781,109 +1678,666 @@ class type_visitor : public node_visitor,
     }
   }
 
-  void visit_call(list* node) {
-    if (node->children.empty()) return;
+  // loops run for their effects, their value is always 0
 
-    auto fn = std::dynamic_pointer_cast<atom>(node->children[0]);
-    if (!fn) {
-      errors.push_back("expected function name");
+  void visit_while(list* node) {
+    if (node->children.size() < 3) {
+      errors.push_back("malformed while expression, expected (while cond body)");
       return;
     }
 
-    std::cout << "--> entering call: " << fn->value << "\n";
+    auto& ts = current_scope->get_type_system();
+
+    node->children[1]->accept(this);
+
+    try {
+      ts.unify(current_type, ts.get_type(TYPE_BOOL));
+    } catch (const std::runtime_error& e) {
+      errors.push_back("loop condition must be boolean: " +
+                       std::string(e.what()));
+    }
+
+    auto block = enter_block();
 
-    std::vector<type_ptr> arg_types;
-    for (size_t i = 1; i < node->children.size(); ++i) {
+    for (size_t i = 2; i < node->children.size(); ++i) {
       node->children[i]->accept(this);
-      arg_types.push_back(current_type);
     }
 
-    try {
-      auto fn_type = current_scope->lookup_type(fn->value);
-      auto result_type = current_scope->get_type_system().fresh_var();
+    leave_block(std::move(block));
+    current_type = ts.get_type(TYPE_INT);
+  }
 
-      type_ptr expected = result_type;
-      for (auto it = arg_types.rbegin(); it != arg_types.rend(); ++it) {
-        expected =
-            current_scope->get_type_system().make_function_type(*it, expected);
-      }
+  void visit_for(list* node) {
+    if (node->children.size() < 7) {
+      errors.push_back(
+          "malformed for expression, expected (for name : int start end "
+          "body)");
+      return;
+    }
+
+    auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+    auto colon = std::dynamic_pointer_cast<atom>(node->children[2]);
+    auto type_node = std::dynamic_pointer_cast<atom>(node->children[3]);
 
-      std::cout << "fn: " << fn->value << "\n";
-      std::cout << "expected: " << expected->to_string() << "\n";
+    if (!name_node || !colon || !type_node || colon->value != TOKEN_COLON) {
+      errors.push_back("malformed for expression");
+      return;
+    }
 
-      current_scope->get_type_system().unify(fn_type, expected);
-      current_type = result_type;
+    auto& ts = current_scope->get_type_system();
+    auto int_t = ts.get_type(TYPE_INT);
+    auto index_t = parse_annotation(type_node->value);
+
+    auto head = std::dynamic_pointer_cast<atom>(node->children[0]);
+    bool parallel = head->value == TOKEN_PARALLEL_FOR;
+
+    if (!integer_type_info(index_t) ||
+        (parallel && index_t->to_string() != TYPE_INT)) {
+      errors.push_back(std::string(parallel ? "parallel-for index must be int: "
+                                            : "loop index must be an integer "
+                                              "type: ") +
+                       index_t->to_string());
+      index_t = int_t;
+    }
+
+    try {
+      for (size_t i = 4; i < 6; ++i) {
+        node->children[i]->accept(this);
+        ts.unify(current_type, index_t);
+      }
     } catch (const std::runtime_error& e) {
-      // errors.push_back("type error in function call: " +
-      // std::string(e.what()));
-      with_error("type error in call expr", node->shared_from_this(), nullptr,
-                 std::string(e.what()));
+      errors.push_back("loop bounds must be " + index_t->to_string() + ": " +
+                       std::string(e.what()));
     }
-  }
 
- public:
-  lisp_parser& parser;
+    // the index is only bound inside the loop, like the body's own lets
+    auto block = enter_block();
+    current_scope->define_read_only(name_node->value, index_t);
 
-  type_visitor(lisp_parser& p) : parser(p) {
-    global_scope = std::make_shared<scope>();
-    current_scope = global_scope;
-  }
+    scope* prev_parallel_body = parallel_body;
+    if (parallel) parallel_body = current_scope;
+
+    for (size_t i = 6; i < node->children.size(); ++i) {
+      node->children[i]->accept(this);
+    }
 
-  void visit(atom* node) override { current_type = infer_literal(node->value); }
+    parallel_body = prev_parallel_body;
+    leave_block(std::move(block));
 
-  void visit(list* node) override {
-    if (node->children.empty()) return;
+    current_type = int_t;
+  }
 
-    auto fst = std::dynamic_pointer_cast<atom>(node->children[0]);
+  // (cast type value) converts between integer, floating point and bool
+  // types, the only place where numeric types change
+  void visit_cast(list* node) {
+    auto& ts = current_scope->get_type_system();
+    auto type_node = node->children.size() == 3
+                         ? std::dynamic_pointer_cast<atom>(node->children[1])
+                         : nullptr;
 
-    if (!fst) {
-      errors.push_back("expected atom as first element of list");
+    if (!type_node) {
+      errors.push_back("malformed cast, expected (cast type value)");
+      current_type = ts.fresh_var();
       return;
     }
 
-    if (fst->value == TOKEN_LET) {
-      visit_let(node);
-    } else if (fst->value == TOKEN_DEF) {
-      visit_def(node);
-    } else if (fst->value == TOKEN_SET) {
-      visit_set(node);
-    } else if (fst->value == TOKEN_IF) {
-      visit_if(node);
-    } else {
-      visit_call(node);
-    }
-  }
+    auto target = parse_annotation(type_node->value);
+    auto is_scalar = [](const type_ptr& t) {
+      auto atomic = std::dynamic_pointer_cast<atomic_type>(t);
+      return is_numeric_type(t) || (atomic && atomic->name == TYPE_BOOL);
+    };
 
-  // @fix: there is this issue where duplicate logs appear filter based on
-  // line-column metadata, errors may need to be unordered_map
+    node->children[2]->accept(this);
+    auto source = resolve(current_type);
 
-  void with_error(const std::string& message, const std::shared_ptr<node>& node,
-                  const type_ptr& type = nullptr,
-                  const std::string& hint = nullptr) {
-    auto [line, column] = parser.get_current_location();
-    std::string context = parser.get_context_line(line);
-    std::string type_repr = type ? type->to_string() : "";
+    if (std::dynamic_pointer_cast<var_type>(source)) {
+      ts.unify(source, ts.get_type(TYPE_INT));
+    } else if (!is_scalar(source)) {
+      errors.push_back("cannot cast from " + source->to_string());
+    }
 
-    errors.push_back(
-        format_error(message, line, column, context, type_repr, hint));
+    // a target that did not parse is a fresh variable, already reported
+    if (!is_scalar(target) && !std::dynamic_pointer_cast<var_type>(target)) {
+      errors.push_back("cannot cast to " + target->to_string());
+    }
+
+    current_type = target;
   }
 
-  const std::vector<std::string>& get_errors() const { return errors; }
-};
+  // (await e) waits for an async<T> and gives its T, inside an async def it
+  // suspends, elsewhere it runs the event loop until e is done. (sleep ms)
+  // suspends an async def for at least ms milliseconds
 
-void register_builtins(std::shared_ptr<scope> scope) {
-  auto& ty = scope->get_type_system();
+  void visit_await(list* node) {
+    auto& ts = current_scope->get_type_system();
+    auto head = std::dynamic_pointer_cast<atom>(node->children[0]);
+    bool sleep = head->value == TOKEN_SLEEP;
 
-  // register primitive types
-  auto int_t = ty.get_type(TYPE_INT);
-  auto bool_t = ty.get_type(TYPE_BOOL);
-  auto string_t = ty.get_type(TYPE_STRING);
+    if (node->children.size() != 2) {
+      errors.push_back("expected (" + head->value + " value)");
+      current_type = ts.fresh_var();
+      return;
+    }
 
-  auto type_var_a = ty.fresh_var();
-  auto type_var_b = ty.fresh_var();
+    if (sleep && !in_async) {
+      errors.push_back("sleep outside of an async def");
+    }
 
-  // we need better heuristics to register ops, i.e. never bind to concrete
-  // types. additionally, skip the type specifier token instead of capturing
+    node->children[1]->accept(this);
+    auto value_t = sleep ? ts.get_type(TYPE_INT) : ts.fresh_var();
+
+    try {
+      ts.unify(current_type,
+               sleep ? value_t : std::make_shared<async_type>(value_t));
+    } catch (const std::runtime_error& e) {
+      errors.push_back("type error in " + head->value + ": " +
+                       std::string(e.what()));
+    }
+
+    current_type = value_t;
+  }
+
+  // the length of (make-array n value) when n is an int literal
+  static std::optional<int> literal_length(const std::shared_ptr<node>& n) {
+    auto l = std::dynamic_pointer_cast<list>(n);
+    auto head = l && l->children.size() == 3
+                    ? std::dynamic_pointer_cast<atom>(l->children[0])
+                    : nullptr;
+    auto length = head && head->value == TOKEN_MAKE_ARRAY
+                      ? std::dynamic_pointer_cast<atom>(l->children[1])
+                      : nullptr;
+
+    try {
+      size_t end = 0;
+      int value = length ? std::stoi(length->value, &end) : -1;
+
+      if (length && end == length->value.size()) return value;
+    } catch (...) {
+    }
+
+    return std::nullopt;
+  }
+
+  // the type named by an annotation, one that does not parse is reported and
+  // checked as a fresh variable
+  type_ptr parse_annotation(const std::string& name) {
+    auto& ts = current_scope->get_type_system();
+
+    try {
+      return ts.get_type(name);
+    } catch (const std::runtime_error& e) {
+      with_error("invalid type", nullptr, nullptr, e.what());
+      return ts.fresh_var();
+    }
+  }
+
+  // the vector operand of a lane, shuffle or reduce form
+  std::shared_ptr<vector_type> vector_operand(const std::shared_ptr<node>& n) {
+    n->accept(this);
+    auto vector = std::dynamic_pointer_cast<vector_type>(resolve(current_type));
+
+    if (!vector) {
+      throw std::runtime_error("expected a vector, found " +
+                               resolve(current_type)->to_string());
+    }
+
+    return vector;
+  }
+
+  void expect_operand(const std::shared_ptr<node>& n, const type_ptr& t) {
+    n->accept(this);
+    current_scope->get_type_system().unify(t, current_type);
+  }
+
+  // (splat vec4f x)                   broadcasts a scalar to every lane
+  // (lane v i), (with-lane v i x)     read and replace one lane
+  // (shuffle v w i...)                picks lanes of v and w by constant index
+  // (reduce-add v) ... (reduce-max v) combine the lanes of one vector
+  // (load-vec vec4f xs i)             reads lanes from xs[i] on
+  // (store-vec xs i v)                writes them back
+
+  void visit_vector_op(list* node, const std::string& op) {
+    auto& ts = current_scope->get_type_system();
+    auto int_t = ts.get_type(TYPE_INT);
+    size_t arity = op == TOKEN_WITH_LANE || op == TOKEN_LOAD_VEC ||
+                           op == TOKEN_STORE_VEC
+                       ? 3
+                   : op == TOKEN_SPLAT || op == TOKEN_LANE ? 2
+                   : op == TOKEN_SHUFFLE ? node->children.size() - 1
+                                         : 1;
+
+    if (node->children.size() != arity + 1) {
+      errors.push_back("incorrect number of arguments passed to " + op);
+      current_type = ts.fresh_var();
+      return;
+    }
+
+    // the result is a vector with a lane per index, and vectors have at least
+    // two lanes. It is given the type of the first operand so enclosing
+    // vector ops do not report the same mistake again
+    if (op == TOKEN_SHUFFLE && arity < 4) {
+      errors.push_back("shuffle expects at least two lane indices");
+      current_type = ts.fresh_var();
+
+      if (arity > 0) {
+        node->children[1]->accept(this);
+
+        if (!std::dynamic_pointer_cast<vector_type>(resolve(current_type))) {
+          current_type = ts.fresh_var();
+        }
+      }
+
+      return;
+    }
+
+    try {
+      if (op == TOKEN_SPLAT || op == TOKEN_LOAD_VEC) {
+        auto type_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+        auto vector = std::dynamic_pointer_cast<vector_type>(
+            type_node ? ts.get_type(type_node->value) : nullptr);
+
+        if (!vector) {
+          throw std::runtime_error(op + " expects a vector type");
+        }
+
+        if (op == TOKEN_SPLAT) {
+          expect_operand(node->children[2], vector->elem_type);
+        } else {
+          expect_operand(node->children[2],
+                         ts.make_array_type(vector->elem_type));
+          expect_operand(node->children[3], int_t);
+        }
+
+        current_type = vector;
+      } else if (op == TOKEN_STORE_VEC) {
+        node->children[1]->accept(this);
+        auto array = current_type;
+        expect_operand(node->children[2], int_t);
+        auto vector = vector_operand(node->children[3]);
+
+        ts.unify(array, ts.make_array_type(vector->elem_type));
+        current_type = vector;
+      } else if (op == TOKEN_SHUFFLE) {
+        auto vector = vector_operand(node->children[1]);
+        expect_operand(node->children[2], vector);
+
+        for (size_t i = 3; i < node->children.size(); ++i) {
+          auto index = std::dynamic_pointer_cast<atom>(node->children[i]);
+          int lane = -1;
+
+          try {
+            lane = index ? std::stoi(index->value) : -1;
+          } catch (...) {
+          }
+
+          if (lane < 0 || size_t(lane) >= 2 * vector->lanes) {
+            throw std::runtime_error(
+                "shuffle lanes must be constants below " +
+                std::to_string(2 * vector->lanes));
+          }
+
+          node->children[i]->accept(this);
+        }
+
+        current_type = std::make_shared<vector_type>(
+            vector->elem_type, node->children.size() - 3);
+      } else {
+        auto vector = vector_operand(node->children[1]);
+
+        if (op == TOKEN_LANE || op == TOKEN_WITH_LANE) {
+          expect_operand(node->children[2], int_t);
+        }
+
+        if (op == TOKEN_WITH_LANE) {
+          expect_operand(node->children[3], vector->elem_type);
+        }
+
+        current_type = op == TOKEN_WITH_LANE ? type_ptr(vector)
+                                             : vector->elem_type;
+      }
+    } catch (const std::runtime_error& e) {
+      errors.push_back("type error in " + op + ": " + std::string(e.what()));
+      current_type = ts.fresh_var();
+    }
+  }
+
+  // a record declaration evaluates to 0 like a loop
+
+  void visit_struct(list* node) {
+    auto& ts = current_scope->get_type_system();
+    auto name_node = node->children.size() > 2
+                         ? std::dynamic_pointer_cast<atom>(node->children[1])
+                         : nullptr;
+    auto layout = std::dynamic_pointer_cast<atom>(node->children.size() > 3
+                                                      ? node->children[2]
+                                                      : nullptr);
+    auto fields = std::dynamic_pointer_cast<list>(node->children.back());
+
+    if (!name_node || !fields || node->children.size() > 4 ||
+        (node->children.size() == 4 && (!layout || layout->value != TOKEN_SOA))) {
+      errors.push_back(
+          "malformed struct declaration, expected (struct name [soa] "
+          "(field : type ...))");
+      return;
+    }
+
+    if (ctx.named_types.count(name_node->value)) {
+      errors.push_back("redefinition of struct " + name_node->value);
+      return;
+    }
+
+    auto record = std::make_shared<struct_type>();
+    record->name = name_node->value;
+    record->soa = layout != nullptr;
+
+    for (size_t i = 0; i + 2 < fields->children.size(); i += 3) {
+      auto field_name = std::dynamic_pointer_cast<atom>(fields->children[i]);
+      auto field_colon = std::dynamic_pointer_cast<atom>(fields->children[i + 1]);
+      auto field_type = std::dynamic_pointer_cast<atom>(fields->children[i + 2]);
+
+      if (!field_name || !field_colon || !field_type ||
+          field_colon->value != TOKEN_COLON ||
+          record->field_index(field_name->value)) {
+        errors.push_back("malformed field in struct " + record->name);
+        return;
+      }
+
+      record->fields.emplace_back(field_name->value,
+                                  parse_annotation(field_type->value));
+    }
+
+    if (record->fields.empty() || fields->children.size() % 3 != 0) {
+      errors.push_back("malformed field list in struct " + record->name);
+      return;
+    }
+
+    ctx.named_types[record->name] = record;
+    current_type = ts.get_type(TYPE_INT);
+  }
+
+  // a type with the bindings of this and every enclosing scope applied
+  type_ptr resolve(type_ptr t) {
+    type_system* applied = nullptr;
+
+    for (scope* s = current_scope; s; s = s->get_outer()) {
+      if (&s->get_type_system() == applied) continue;
+
+      applied = &s->get_type_system();
+      t = applied->get_final_type(t);
+    }
+
+    return t;
+  }
+
+  // the record type of an expression must be known where a field is used,
+  // bindings made in enclosing scopes are followed as well
+  std::shared_ptr<struct_type> record_type_of(type_ptr t) {
+    t = resolve(t);
+    auto record = std::dynamic_pointer_cast<struct_type>(t);
+
+    if (!record) {
+      errors.push_back("expected a struct, found " + t->to_string());
+    }
+
+    return record;
+  }
+
+  void visit_new(list* node) {
+    auto& ts = current_scope->get_type_system();
+    auto name_node = node->children.size() > 1
+                         ? std::dynamic_pointer_cast<atom>(node->children[1])
+                         : nullptr;
+
+    auto record =
+        name_node ? std::dynamic_pointer_cast<struct_type>(
+                        parse_annotation(name_node->value))
+                  : nullptr;
+
+    if (!record) {
+      errors.push_back("expected (new struct-name values...)");
+      return;
+    }
+
+    if (node->children.size() - 2 != record->fields.size()) {
+      errors.push_back("wrong number of fields for struct " + record->name);
+      return;
+    }
+
+    for (size_t i = 2; i < node->children.size(); ++i) {
+      node->children[i]->accept(this);
+
+      try {
+        ts.unify(record->fields[i - 2].second, current_type);
+      } catch (const std::runtime_error& e) {
+        errors.push_back("type error in field " + record->fields[i - 2].first +
+                         ": " + std::string(e.what()));
+      }
+    }
+
+    current_type = record;
+  }
+
+  // (field value name) reads a field, (with value name new) copies the record
+  // with one field replaced
+  void visit_field_access(list* node, bool update) {
+    size_t expected = update ? 4 : 3;
+    auto field_node = node->children.size() == expected
+                          ? std::dynamic_pointer_cast<atom>(node->children[2])
+                          : nullptr;
+
+    if (!field_node) {
+      errors.push_back(update ? "expected (with value field new-value)"
+                              : "expected (field value field-name)");
+      return;
+    }
+
+    node->children[1]->accept(this);
+    auto record = record_type_of(current_type);
+
+    if (!record) return;
+
+    auto index = record->field_index(field_node->value);
+
+    if (!index) {
+      errors.push_back("struct " + record->name + " has no field " +
+                       field_node->value);
+      return;
+    }
+
+    auto field_t = record->fields[*index].second;
+
+    if (update) {
+      node->children[3]->accept(this);
+
+      try {
+        current_scope->get_type_system().unify(field_t, current_type);
+      } catch (const std::runtime_error& e) {
+        errors.push_back("type error in field " + field_node->value + ": " +
+                         std::string(e.what()));
+      }
+    }
+
+    current_type = update ? type_ptr(record) : field_t;
+  }
+
+  // arithmetic and comparisons take any numeric type, operands that are still
+  // unconstrained default to int. arithmetic also works lane-wise on vectors
+  void check_numeric(const type_ptr& operand, bool allow_vector) {
+    auto& ts = current_scope->get_type_system();
+    type_ptr t = resolve(operand);
+
+    if (std::dynamic_pointer_cast<var_type>(t)) {
+      ts.unify(t, ts.get_type(TYPE_INT));
+    } else if (!is_numeric_type(t) &&
+               !(allow_vector && std::dynamic_pointer_cast<vector_type>(t))) {
+      throw std::runtime_error("expected a number but found " + t->to_string());
+    }
+  }
+
+  void visit_call(list* node) {
+    if (node->children.empty()) return;
+
+    auto fn = std::dynamic_pointer_cast<atom>(node->children[0]);
+    if (!fn) {
+      errors.push_back("expected function name");
+      return;
+    }
+
+    // the right operand of and/or may not run, so it is a block like a branch
+    bool logical = fn->value == TOKEN_AND || fn->value == TOKEN_OR;
+
+    std::vector<type_ptr> arg_types;
+    for (size_t i = 1; i < node->children.size(); ++i) {
+      if (logical && i == 2) {
+        auto block = enter_block();
+        node->children[i]->accept(this);
+        leave_block(std::move(block));
+      } else {
+        node->children[i]->accept(this);
+      }
+
+      arg_types.push_back(current_type);
+    }
+
+    try {
+      auto fn_type = current_scope->lookup_type(fn->value);
+      auto result_type = current_scope->get_type_system().fresh_var();
+
+      type_ptr expected = result_type;
+      for (auto it = arg_types.rbegin(); it != arg_types.rend(); ++it) {
+        expected =
+            current_scope->get_type_system().make_function_type(*it, expected);
+      }
+
+      current_scope->get_type_system().unify(fn_type, expected);
+      current_type = result_type;
+
+      if (is_numeric_op(fn->value) && !arg_types.empty()) {
+        check_numeric(arg_types[0], is_arithmetic_op(fn->value));
+      }
+    } catch (const std::runtime_error& e) {
+      // errors.push_back("type error in function call: " +
+      // std::string(e.what()));
+      with_error("type error in call expr", node->shared_from_this(), nullptr,
+                 std::string(e.what()));
+    }
+  }
+
+ public:
+  lisp_parser& parser;
+  compiler_context& ctx;
+
+  type_visitor(lisp_parser& p, compiler_context& c)
+      : scopes(c), parser(p), ctx(c) {
+    global_scope = std::make_unique<scope>(ctx);
+    current_scope = global_scope.get();
+    register_builtins(global_scope.get());
+  }
+
+  void visit(atom* node) override {
+    if (captures_enclosing_def(node->value)) {
+      with_error("cannot read a variable of an enclosing def", nullptr,
+                 nullptr,
+                 "a def sees its own bindings, other defs and top-level "
+                 "bindings: " +
+                     node->value);
+    }
+
+    current_type = infer_literal(node->value);
+    record_type(node);
+  }
+
+  void visit(list* node) override {
+    if (node->children.empty()) return;
+
+    auto fst = std::dynamic_pointer_cast<atom>(node->children[0]);
+
+    if (!fst) {
+      errors.push_back("expected atom as first element of list");
+      return;
+    }
+
+    if (fst->value == TOKEN_PROGRAM) {
+      visit_program(node);
+    } else if (fst->value == TOKEN_LET) {
+      visit_let(node);
+    } else if (fst->value == TOKEN_DEF) {
+      visit_def(node);
+    } else if (fst->value == TOKEN_SET) {
+      visit_set(node);
+    } else if (fst->value == TOKEN_IF) {
+      visit_if(node);
+    } else if (fst->value == TOKEN_WHILE) {
+      visit_while(node);
+    } else if (fst->value == TOKEN_FOR || fst->value == TOKEN_PARALLEL_FOR) {
+      visit_for(node);
+    } else if (fst->value == TOKEN_CAST) {
+      visit_cast(node);
+    } else if (is_vector_op(fst->value)) {
+      visit_vector_op(node, fst->value);
+    } else if (fst->value == TOKEN_AWAIT || fst->value == TOKEN_SLEEP) {
+      visit_await(node);
+    } else if (fst->value == TOKEN_STRUCT) {
+      visit_struct(node);
+    } else if (fst->value == TOKEN_NEW) {
+      visit_new(node);
+    } else if (fst->value == TOKEN_FIELD || fst->value == TOKEN_WITH) {
+      visit_field_access(node, fst->value == TOKEN_WITH);
+    } else {
+      visit_call(node);
+    }
+
+    record_type(node);
+  }
+
+  // resolves the types left in the global scope once the whole program has
+  // been checked, lowering reads them through get_node_types
+  void finalize_types() {
+    auto& ts = global_scope->get_type_system();
+
+    for (auto& [n, t] : open_types.front()) {
+      node_types[n] = ts.get_final_type(t);
+    }
+
+    open_types.front().clear();
+  }
+
+  const node_type_map& get_node_types() const { return node_types; }
+  node_type_map& get_node_types() { return node_types; }
+
+  // @fix: there is this issue where duplicate logs appear filter based on
+  // line-column metadata, errors may need to be unordered_map
+
+  void with_error(const std::string& message, const std::shared_ptr<node>&,
+                  const type_ptr& type = nullptr,
+                  const std::string& hint = nullptr) {
+    auto [line, column] = parser.get_current_location();
+    std::string context = parser.get_context_line(line);
+    std::string type_repr = type ? type->to_string() : "";
+
+    errors.push_back(
+        format_error(message, line, column, context, type_repr, hint));
+  }
+
+  const std::vector<std::string>& get_errors() const { return errors; }
+};
+
+void register_builtins(scope* scope) {
+  auto& ty = scope->get_type_system();
+
+  // register primitive types
+  auto int_t = ty.get_type(TYPE_INT);
+  auto bool_t = ty.get_type(TYPE_BOOL);
+  auto string_t = ty.get_type(TYPE_STRING);
+
+  // lowered to the c library's printf, only the format string is typed
+  scope->define_type("printf", ty.make_function_type(string_t, int_t));
+
+  auto type_var_a = ty.fresh_var();
+  auto type_var_b = ty.fresh_var();
+
+  // we need better heuristics to register ops, i.e. never bind to concrete
+  // types. additionally, skip the type specifier token instead of capturing
 
   scope->define_type(TOKEN_COLON,
                      ty.make_function_type(type_var_a, type_var_b));
@@ -896,767 +2350,3591 @@ void register_builtins(std::shared_ptr<scope> scope) {
   scope->define_type(TYPE_BOOL, ty.make_function_type(type_var_a, type_var_b));
   scope->define_type("k", ty.make_function_type(type_var_a, type_var_b));
 
-  // we reduce lhs and rhs to a single type, and then unify the two
-  // program is a callable type that just composes arg types
-  scope->define_type(TOKEN_PROGRAM,
-                     ty.make_function_type(type_var_a, type_var_b));
+  // we reduce lhs and rhs to a single type, and then unify the two
+  // program is a callable type that just composes arg types
+  scope->define_type(TOKEN_PROGRAM,
+                     ty.make_function_type(type_var_a, type_var_b));
+
+  // arithmetic and comparisons are generic over the operand type, the type
+  // checker restricts it to int, float and double
+  for (const char* op : {TOKEN_ADD, TOKEN_SUB, TOKEN_MUL, TOKEN_DIV}) {
+    auto num_t = ty.fresh_var();
+    auto num_id = std::dynamic_pointer_cast<var_type>(num_t)->id;
+
+    scope->define_type(
+        op, ty.make_function_type(num_t, ty.make_function_type(num_t, num_t)),
+        {num_id});
+  }
+
+  for (const char* op :
+       {TOKEN_EQ, TOKEN_GT, TOKEN_LT, TOKEN_NEQ, TOKEN_LEQ, TOKEN_GEQ}) {
+    auto num_t = ty.fresh_var();
+    auto num_id = std::dynamic_pointer_cast<var_type>(num_t)->id;
+
+    scope->define_type(
+        op, ty.make_function_type(num_t, ty.make_function_type(num_t, bool_t)),
+        {num_id});
+  }
+
+  // arrays are generic over their element type
+  auto elem_t = ty.fresh_var();
+  auto elem_id = std::dynamic_pointer_cast<var_type>(elem_t)->id;
+  auto array_t = ty.make_array_type(elem_t);
+
+  scope->define_type(
+      TOKEN_MAKE_ARRAY,
+      ty.make_function_type(int_t, ty.make_function_type(elem_t, array_t)),
+      {elem_id});
+  scope->define_type(
+      TOKEN_ARRAY_GET,
+      ty.make_function_type(array_t, ty.make_function_type(int_t, elem_t)),
+      {elem_id});
+  scope->define_type(
+      TOKEN_ARRAY_SET,
+      ty.make_function_type(
+          array_t,
+          ty.make_function_type(int_t, ty.make_function_type(elem_t, elem_t))),
+      {elem_id});
+  scope->define_type(TOKEN_ARRAY_LEN, ty.make_function_type(array_t, int_t),
+                     {elem_id});
+
+  // (parallel-map f xs) maps a def of one argument over an array
+  auto from_t = ty.fresh_var();
+  auto to_t = ty.fresh_var();
+  auto from_id = std::dynamic_pointer_cast<var_type>(from_t)->id;
+  auto to_id = std::dynamic_pointer_cast<var_type>(to_t)->id;
+
+  scope->define_type(
+      TOKEN_PARALLEL_MAP,
+      ty.make_function_type(ty.make_function_type(from_t, to_t),
+                            ty.make_function_type(ty.make_array_type(from_t),
+                                                  ty.make_array_type(to_t))),
+      {from_id, to_id});
+
+  scope->define_type(
+      TOKEN_AND,
+      ty.make_function_type(bool_t, ty.make_function_type(bool_t, bool_t)));
+  scope->define_type(
+      TOKEN_OR,
+      ty.make_function_type(bool_t, ty.make_function_type(bool_t, bool_t)));
+}
+
+// folds integer arithmetic and comparisons over literals and replaces an if
+// with a constant condition by the branch it takes. runs after type checking,
+// a replacement takes over the type of the node it replaces
+
+class constant_folder {
+  node_type_map& types;
+
+  std::shared_ptr<node> replace(const std::shared_ptr<node>& old,
+                                std::shared_ptr<node> with) {
+    auto it = types.find(old.get());
+
+    if (it != types.end()) {
+      types[with.get()] = it->second;
+    }
+
+    return with;
+  }
+
+  static std::optional<int32_t> int_constant(const std::shared_ptr<node>& n) {
+    auto a = std::dynamic_pointer_cast<atom>(n);
+
+    if (!a) return std::nullopt;
+
+    try {
+      size_t end = 0;
+      int value = std::stoi(a->value, &end);
+
+      if (end == a->value.size()) return value;
+    } catch (...) {
+    }
+
+    return std::nullopt;
+  }
+
+  static std::optional<bool> bool_constant(const std::shared_ptr<node>& n) {
+    auto a = std::dynamic_pointer_cast<atom>(n);
+
+    if (a && a->value == TOKEN_TRUE) return true;
+    if (a && a->value == TOKEN_FALSE) return false;
+
+    return std::nullopt;
+  }
+
+  // a branch that binds names cannot be spliced into its parent, each branch
+  // is lowered in its own scope and the bindings would escape it
+  static bool binds_names(const std::shared_ptr<node>& n) {
+    auto l = std::dynamic_pointer_cast<list>(n);
+
+    if (!l || l->children.empty()) return false;
+
+    auto head = std::dynamic_pointer_cast<atom>(l->children[0]);
+
+    if (head && (head->value == TOKEN_LET || head->value == TOKEN_DEF)) {
+      return true;
+    }
+
+    if (head && head->value == TOKEN_IF) return false;
+
+    // loop bodies are scoped like branches, only the header can bind
+    if (head && head->value == TOKEN_WHILE) return binds_names(l->children[1]);
+
+    if (head && (head->value == TOKEN_FOR || head->value == TOKEN_PARALLEL_FOR) &&
+        l->children.size() > 5) {
+      return binds_names(l->children[4]) || binds_names(l->children[5]);
+    }
+
+    return std::any_of(l->children.begin(), l->children.end(), binds_names);
+  }
+
+  // evaluates with the wrapping semantics of the generated i32 code, division
+  // that would trap is left to run time
+  static std::optional<std::string> evaluate(const std::string& op, int32_t l,
+                                             int32_t r) {
+    auto wrap = [](int64_t v) {
+      return std::to_string(static_cast<int32_t>(static_cast<uint32_t>(v)));
+    };
+    auto truth = [](bool v) { return v ? TOKEN_TRUE : TOKEN_FALSE; };
+
+    if (op == TOKEN_ADD) return wrap(int64_t(l) + r);
+    if (op == TOKEN_SUB) return wrap(int64_t(l) - r);
+    if (op == TOKEN_MUL) return wrap(int64_t(l) * r);
+    if (op == TOKEN_DIV) {
+      if (r == 0 || (l == std::numeric_limits<int32_t>::min() && r == -1)) {
+        return std::nullopt;
+      }
+
+      return std::to_string(l / r);
+    }
+    if (op == TOKEN_EQ) return truth(l == r);
+    if (op == TOKEN_NEQ) return truth(l != r);
+    if (op == TOKEN_LT) return truth(l < r);
+    if (op == TOKEN_GT) return truth(l > r);
+    if (op == TOKEN_LEQ) return truth(l <= r);
+    if (op == TOKEN_GEQ) return truth(l >= r);
+
+    return std::nullopt;
+  }
+
+  void fold_children(list* l, size_t begin) {
+    for (size_t i = begin; i < l->children.size(); ++i) {
+      l->children[i] = fold(l->children[i]);
+    }
+  }
+
+ public:
+  explicit constant_folder(node_type_map& t) : types(t) {}
+
+  std::shared_ptr<node> fold(const std::shared_ptr<node>& n) {
+    auto l = std::dynamic_pointer_cast<list>(n);
+
+    if (!l || l->children.empty()) return n;
+
+    auto head = std::dynamic_pointer_cast<atom>(l->children[0]);
+
+    if (!head) return n;
+
+    if (head->value == TOKEN_DEF) {
+      fold_children(l.get(), 5);
+      return n;
+    }
+
+    if (head->value == TOKEN_STRUCT) return n;
+
+    if (head->value == TOKEN_LET) {
+      fold_children(l.get(), 4);
+      return n;
+    }
+
+    if (head->value == TOKEN_SET) {
+      fold_children(l.get(), 2);
+      return n;
+    }
+
+    fold_children(l.get(), 1);
+
+    // a constant left operand either decides the result or hands it to the
+    // right operand
+    if ((head->value == TOKEN_AND || head->value == TOKEN_OR) &&
+        l->children.size() == 3) {
+      if (auto lhs = bool_constant(l->children[1])) {
+        bool decides = *lhs == (head->value == TOKEN_OR);
+
+        if (decides) return l->children[1];
+        if (!binds_names(l->children[2])) return l->children[2];
+      }
+
+      return n;
+    }
+
+    if (head->value == TOKEN_WHILE && l->children.size() > 2 &&
+        bool_constant(l->children[1]) == false) {
+      return replace(n, std::make_shared<atom>("0"));
+    }
+
+    if (head->value == TOKEN_IF && l->children.size() == 4) {
+      if (auto cond = bool_constant(l->children[1])) {
+        auto& taken = l->children[*cond ? 2 : 3];
+
+        if (!binds_names(taken)) return taken;
+      }
+
+      return n;
+    }
+
+    if (l->children.size() == 3) {
+      auto lhs = int_constant(l->children[1]);
+      auto rhs = int_constant(l->children[2]);
+
+      if (lhs && rhs) {
+        if (auto value = evaluate(head->value, *lhs, *rhs)) {
+          return replace(n, std::make_shared<atom>(*value));
+        }
+      }
+    }
+
+    return n;
+  }
+};
+
+class llvm_codegen;
+
+class codegen_error : public std::runtime_error {
+ public:
+  explicit codegen_error(const std::string& message)
+      : std::runtime_error(message) {}
+};
+
+// immutable variables are bound straight to their ssa value, only variables
+// that are targets of `set` live in an alloca that is loaded on every use
+// a mutable binding is the address of a stack slot holding `slot_type`
+struct codegen_binding {
+  llvm::Value* value = nullptr;
+  bool is_mutable = false;
+  llvm::Type* slot_type = nullptr;
+};
+
+class codegen_scope : public std::enable_shared_from_this<codegen_scope> {
+ private:
+  std::shared_ptr<codegen_scope> parent;
+  std::unordered_map<std::string, codegen_binding> value_map;
+  std::unordered_map<std::string, llvm::Function*> function_map;
+  std::unordered_map<std::string, std::shared_ptr<list>> generic_map;
+
+ public:
+  explicit codegen_scope(std::shared_ptr<codegen_scope> p = nullptr)
+      : parent(p) {}
+
+  void set_value(const std::string& name, llvm::Value* value,
+                 bool is_mutable = false, llvm::Type* slot_type = nullptr) {
+    if (is_mutable && !slot_type) {
+      slot_type = llvm::cast<llvm::AllocaInst>(value)->getAllocatedType();
+    }
+
+    value_map[name] = {value, is_mutable, slot_type};
+  }
+
+  void set_function(const std::string& name, llvm::Function* func) {
+    function_map[name] = func;
+    generic_map.erase(name);
+  }
+
+  // a polymorphic def has no function of its own, only specializations
+  void set_generic(const std::string& name, std::shared_ptr<list> def) {
+    generic_map[name] = std::move(def);
+    function_map.erase(name);
+  }
+
+  std::shared_ptr<list> get_generic(const std::string& name) const {
+    auto it = generic_map.find(name);
+    if (it != generic_map.end()) {
+      return it->second;
+    }
+
+    if (function_map.count(name) || !parent) {
+      return nullptr;
+    }
+
+    return parent->get_generic(name);
+  }
+
+  const codegen_binding* get_value(const std::string& name) const {
+    auto it = value_map.find(name);
+    if (it != value_map.end()) {
+      return &it->second;
+    }
+
+    if (parent) {
+      return parent->get_value(name);
+    }
+
+    return nullptr;
+  }
+
+  llvm::Function* get_function(const std::string& name) const {
+    auto it = function_map.find(name);
+    if (it != function_map.end()) {
+      return it->second;
+    }
+
+    if (generic_map.count(name)) {
+      return nullptr;
+    }
+
+    if (parent) {
+      return parent->get_function(name);
+    }
+
+    return nullptr;
+  }
+
+  std::shared_ptr<codegen_scope> create_child() {
+    return std::make_shared<codegen_scope>(shared_from_this());
+  }
+};
+
+struct llvm_type_mapping {
+  std::unordered_map<std::string, llvm::Type*> type_map;
+
+  llvm::Type* get_type(llvm::LLVMContext& context, const std::string& name) {
+    auto it = type_map.find(name);
+    if (it != type_map.end()) {
+      return it->second;
+    }
+
+    if (name == TYPE_INT) {
+      auto result = llvm::Type::getInt32Ty(context);
+      type_map[name] = result;
+      return result;
+    } else if (name == TYPE_BOOL) {
+      auto result = llvm::Type::getInt1Ty(context);
+      type_map[name] = result;
+      return result;
+    } else if (name == "void") {
+      auto result = llvm::Type::getVoidTy(context);
+      type_map[name] = result;
+      return result;
+    } else if (name == TYPE_STRING) {
+      auto result = llvm::Type::getInt8PtrTy(context);
+      type_map[name] = result;
+      return result;
+    } else if (name == TYPE_FLOAT) {
+      auto result = llvm::Type::getFloatTy(context);
+      type_map[name] = result;
+      return result;
+    } else if (name == TYPE_DOUBLE) {
+      auto result = llvm::Type::getDoubleTy(context);
+      type_map[name] = result;
+      return result;
+    } else if (auto info = integer_type_info(name)) {
+      auto result = llvm::Type::getIntNTy(context, info->bits);
+      type_map[name] = result;
+      return result;
+    }
+
+    throw codegen_error("unknown type: " + name);
+  }
+};
+
+struct function_type_info {
+  llvm::Type* return_type;
+  std::vector<llvm::Type*> param_types;
+
+  llvm::FunctionType* create_function_type() const {
+    return llvm::FunctionType::get(return_type, param_types, false);
+  }
+};
+
+struct param_info {
+  std::string name;
+  std::string type_name;
+};
+
+class llvm_codegen : public std::enable_shared_from_this<llvm_codegen> {
+ private:
+  llvm::LLVMContext* context;
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<llvm::IRBuilder<>> builder;
+  std::unique_ptr<llvm::TargetMachine> target_machine;
+
+  std::shared_ptr<codegen_scope> global_scope;
+  std::shared_ptr<codegen_scope> current_scope;
+
+  llvm_type_mapping type_mapper;
+
+  std::unordered_map<std::string, llvm::Function*> intrinsic_functions;
+
+  // constant data is emitted once per module, llvm uniques the initializers
+  // so equal data maps to the same pool entry
+  std::unordered_map<llvm::Constant*, llvm::Constant*> constant_pool;
+
+ public:
+  llvm_codegen(compiler_context& ctx, const std::string& module_name)
+      : context(ctx.llvm_context.get()),
+        module(std::make_unique<llvm::Module>(module_name, *context)),
+        builder(std::make_unique<llvm::IRBuilder<>>(*context)) {
+    global_scope = std::make_shared<codegen_scope>();
+    current_scope = global_scope;
+
+    initialize_intrinsics();
+  }
+
+  llvm::LLVMContext& get_context() { return *context; }
+  llvm::Module& get_module() { return *module; }
+  std::unique_ptr<llvm::Module> take_module() { return std::move(module); }
+  void link_in(std::unique_ptr<llvm::Module> other);
+  llvm::IRBuilder<>& get_builder() { return *builder; }
+
+  void set_current_scope(std::shared_ptr<codegen_scope> scope) {
+    current_scope = scope;
+  }
+
+  std::shared_ptr<codegen_scope> get_current_scope() { return current_scope; }
+  std::shared_ptr<codegen_scope> get_global_scope() { return global_scope; }
+
+  std::shared_ptr<codegen_scope> create_new_scope() {
+    auto new_scope = current_scope->create_child();
+    return new_scope;
+  }
+
+  llvm::Type* get_llvm_type(const std::string& type_name) {
+    return type_mapper.get_type(*context, type_name);
+  }
+
+  // a type variable left after type checking has no machine representation
+  llvm::Type* get_llvm_type(const type_ptr& t) {
+    if (auto atomic = std::dynamic_pointer_cast<atomic_type>(t)) {
+      return get_llvm_type(atomic->name);
+    }
+
+    if (auto record = std::dynamic_pointer_cast<struct_type>(t)) {
+      return get_struct_type(*record);
+    }
+
+    if (auto vector = std::dynamic_pointer_cast<vector_type>(t)) {
+      return llvm::FixedVectorType::get(get_llvm_type(vector->elem_type),
+                                        vector->lanes);
+    }
+
+    // an async value is the handle of the coroutine computing it
+    if (std::dynamic_pointer_cast<async_type>(t)) {
+      return builder->getInt8PtrTy();
+    }
+
+    if (auto array = std::dynamic_pointer_cast<array_type>(t)) {
+      auto record = std::dynamic_pointer_cast<struct_type>(array->elem_type);
+
+      if (record && record->soa) {
+        return get_soa_array_type(*record);
+      }
+
+      return get_array_type(get_llvm_type(array->elem_type));
+    }
+
+    throw codegen_error("cannot lower unresolved type " + t->to_string());
+  }
+
+  // arrays are passed by value as { T* data, i32 length }, the elements live
+  // on the heap and are shared by every copy
+  llvm::StructType* get_array_type(llvm::Type* elem) {
+    return llvm::StructType::get(*context,
+                                 {elem->getPointerTo(), builder->getInt32Ty()});
+  }
+
+  // records become named structs, one per declaration
+  llvm::StructType* get_struct_type(const struct_type& record) {
+    auto it = type_mapper.type_map.find(record.name);
+
+    if (it != type_mapper.type_map.end()) {
+      return llvm::cast<llvm::StructType>(it->second);
+    }
+
+    std::vector<llvm::Type*> fields;
+    for (const auto& field : record.fields) {
+      fields.push_back(get_llvm_type(field.second));
+    }
+
+    auto* result = llvm::StructType::create(*context, fields, record.name);
+    type_mapper.type_map[record.name] = result;
+
+    return result;
+  }
+
+  // { f1* data, f2* data, ..., i32 length } for arrays of a `soa` record
+  llvm::StructType* get_soa_array_type(const struct_type& record) {
+    std::vector<llvm::Type*> members;
+    for (llvm::Type* field : get_struct_type(record)->elements()) {
+      members.push_back(field->getPointerTo());
+    }
+    members.push_back(builder->getInt32Ty());
+
+    return llvm::StructType::get(*context, members);
+  }
+
+  llvm::AllocaInst* create_entry_block_alloca(llvm::Function* function,
+                                              const std::string& var_name,
+                                              llvm::Type* type) {
+    llvm::IRBuilder<> temp_builder(&function->getEntryBlock(),
+                                   function->getEntryBlock().begin());
+    return temp_builder.CreateAlloca(type, nullptr, var_name);
+  }
+
+  void initialize_intrinsics();
+  llvm::Function* get_intrinsic(const std::string& name);
+
+  llvm::Constant* get_pooled_constant(llvm::Constant* data,
+                                      const std::string& name = ".const");
+  llvm::Constant* get_string_constant(const std::string& value);
+
+  function_type_info get_function_type_info(const type_ptr& fn_type,
+                                            size_t arity);
+
+  static llvm::AllocaInst* create_entry_block_alloca_for_func(
+      llvm::Function* function, const std::string& var_name, llvm::Type* type) {
+    llvm::IRBuilder<> temp_builder(&function->getEntryBlock(),
+                                   function->getEntryBlock().begin());
+    return temp_builder.CreateAlloca(type, nullptr, var_name);
+  }
+
+  void initialize_target(const std::string& cpu, llvm::OptimizationLevel level);
+
+  // floating point instructions emitted from here on may be reassociated and
+  // contracted and assume no NaNs, which lets fp reductions vectorize
+  void enable_fast_math() {
+    llvm::FastMathFlags flags;
+    flags.setAllowReassoc();
+    flags.setAllowContract();
+    flags.setNoNaNs();
+    builder->setFastMathFlags(flags);
+  }
+
+  llvm::TargetMachine* get_target_machine() { return target_machine.get(); }
+
+  void emit_to_file(const std::string& filename);
+  void emit_bitcode(const std::string& filename);
+  void emit_native(const std::string& filename, llvm::CodeGenFileType type);
+  void verify();
+  void optimize(llvm::OptimizationLevel level, std::ostream* timing = nullptr);
+  void dump_ir(std::ostream& os);
+};
+
+void initialize_native_target();
+
+class codegen_visitor {
+ private:
+  std::shared_ptr<llvm_codegen> generator;
+  const node_type_map* node_types;
+
+  // while a specialization is lowered its type variables are bound to the
+  // concrete types of the call site
+  std::unordered_map<int, type_ptr> type_bindings;
+
+  type_ptr type_of(const node* n) const {
+    auto it = node_types->find(n);
+
+    if (it == node_types->end()) {
+      throw codegen_error("no type inferred for expression");
+    }
+
+    return type_bindings.empty() ? it->second
+                                 : it->second->substitute(type_bindings);
+  }
+
+  llvm::Type* llvm_type_of(const node* n) {
+    return generator->get_llvm_type(type_of(n));
+  }
+
+  llvm::Value* codegen_atom(const std::shared_ptr<atom>& node);
+  llvm::Value* codegen_sequence(const std::shared_ptr<list>& node,
+                                size_t begin, bool tail = false);
+  llvm::Value* codegen_let(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_set(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_if(const std::shared_ptr<list>& node, bool tail);
+  llvm::Value* codegen_logical(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_while(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_for(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_parallel_for(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_await(const std::shared_ptr<list>& node);
+  std::shared_ptr<async_type> async_result(const std::shared_ptr<list>& def);
+  llvm::StructType* promise_type(llvm::Type* value_type);
+  llvm::Value* promise_of(llvm::Value* handle, llvm::StructType* type);
+  void begin_coroutine(llvm::Function* func, llvm::Type* value_type);
+  void end_coroutine(llvm::Value* value);
+  void emit_suspend(bool final);
+  llvm::Value* codegen_parallel_map(const std::shared_ptr<list>& node);
+  void emit_loop(llvm::Value* start, llvm::Value* end, bool is_unsigned,
+                 const std::string& name,
+                 const std::function<void(llvm::Value* index)>& body);
+  void emit_parallel_loop(
+      llvm::Value* begin, llvm::Value* end, const std::string& name,
+      const std::map<std::string, codegen_binding>& captures,
+      const std::function<void(llvm::Value* index)>& body);
+  llvm::Value* codegen_array_op(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_make_array(llvm::Value* length, llvm::Value* init,
+                                  const struct_type* soa);
+  llvm::Value* allocate_array(llvm::Value* length, llvm::Type* elem_type);
+  llvm::Value* allocate_filled(llvm::Value* length, llvm::Value* value);
+  void check_index(llvm::Value* array, llvm::Value* index);
+  llvm::Value* codegen_record(const std::shared_ptr<list>& node);
+  void emit_check(llvm::Value* ok, const std::string& name);
+  llvm::Value* codegen_def(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_call(const std::shared_ptr<list>& node, bool tail);
+  llvm::Value* codegen_cast(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_vector_op(const std::shared_ptr<list>& node);
+  llvm::Value* codegen_binary_op(const std::string& op, bool is_unsigned,
+                                 llvm::Value* lhs,
+                                 llvm::Value* rhs);
+  void return_value(llvm::Value* value);
+
+  // clang-format off
+  std::unordered_map<const list*, llvm::Function*> declared_defs;
+  std::unordered_set<const list*>                  external_defs;
+  std::unordered_set<std::string>                  assigned_names;
+  // clang-format on
+
+  // the def whose body is being lowered, a self call in tail position jumps
+  // back to `header` with the new arguments fed into the parameter phis
+  struct tail_target {
+    llvm::Function* function = nullptr;
+    llvm::BasicBlock* header = nullptr;
+    std::vector<llvm::PHINode*> params;
+  };
+
+  tail_target current_def;
+
+  // the async def being lowered, its body suspends by branching to `suspend`
+  // and is torn down through `cleanup`
+  struct coroutine {
+    llvm::Value* id = nullptr;
+    llvm::Value* handle = nullptr;
+    llvm::Value* promise = nullptr;
+    llvm::StructType* promise_type = nullptr;
+    llvm::BasicBlock* cleanup = nullptr;
+    llvm::BasicBlock* suspend = nullptr;
+  };
+
+  coroutine current_coro;
+
+  // (index, end) of the enclosing for loops that count up from a non-negative
+  // start, an index is known to be below end inside the body
+  std::vector<std::pair<llvm::Value*, llvm::Value*>> loop_bounds;
+
+  llvm::Value* bind_variable(const std::string& name, llvm::Value* value);
+
+  // top-level lets that defs read or assign, the ones that do not lower to
+  // a constant live in a module global because a def cannot reach the ssa
+  // values of main. with partitions every one of them does, so the other
+  // partitions can declare it
+  std::unordered_set<std::string> def_reads;
+  std::unordered_set<std::string> def_assigned;
+  bool partitioned = false;
+
+  void collect_def_names(const std::shared_ptr<typed_lisp::node>& ast);
+  bool needs_global(const std::string& name, llvm::Value* value);
+  llvm::Value* bind_global(const std::string& name, llvm::Value* value);
+  void declare_global(const std::shared_ptr<list>& let);
+
+  // clang-format off
+  std::unordered_map<const list*, std::shared_ptr<codegen_scope>> generic_scopes;
+  std::map<std::pair<const list*, std::string>, llvm::Function*>  specializations;
+  // clang-format on
+
+  llvm::Function* declare_def(const std::shared_ptr<list>& node);
+  llvm::Function* create_prototype(const std::shared_ptr<list>& node,
+                                   const type_ptr& fn_type,
+                                   const std::string& name,
+                                   llvm::GlobalValue::LinkageTypes linkage);
+  void define_def(const std::shared_ptr<list>& node, llvm::Function* func);
+  llvm::Function* specialize(const std::shared_ptr<list>& def,
+                             const std::shared_ptr<list>& call);
+
+ public:
+  // lowering is driven by the types inferred by type_visitor, see
+  // type_visitor::get_node_types
+  codegen_visitor(std::shared_ptr<llvm_codegen> gen, const node_type_map& types)
+      : generator(std::move(gen)), node_types(&types) {}
+
+  // lowers the whole program into `main`, defs become module-level functions
+  llvm::Function* codegen_program(const std::shared_ptr<typed_lisp::node>& ast);
+
+  // `tail` marks a node whose value is returned by the enclosing def, such a
+  // node may leave the insert block terminated when it returns by itself
+  llvm::Value* codegen_node(const std::shared_ptr<typed_lisp::node>& node,
+                            bool tail = false);
+
+  // used when the program is split into partitions lowered by separate
+  // workers, every top-level def gets a prototype but only the owned ones a
+  // body, main is lowered by a single partition
+
+  void declare_top_level_defs(const std::shared_ptr<typed_lisp::node>& ast);
+  void set_external_defs(std::unordered_set<const list*> defs) {
+    external_defs = std::move(defs);
+  }
+  void codegen_defs(const std::shared_ptr<typed_lisp::node>& ast);
+};
+
+std::vector<std::shared_ptr<list>> top_level_defs(
+    const std::shared_ptr<typed_lisp::node>& ast);
+
+// the function an ssa value belongs to, constants and globals belong to none
+llvm::Function* owning_function(llvm::Value* value) {
+  if (auto* arg = llvm::dyn_cast<llvm::Argument>(value)) {
+    return arg->getParent();
+  }
+
+  if (auto* inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+    return inst->getFunction();
+  }
+
+  return nullptr;
+}
+
+llvm::Value* codegen_visitor::codegen_atom(const std::shared_ptr<atom>& node) {
+  const std::string& value = node->value;
+
+  if (value == TOKEN_TRUE) {
+    return llvm::ConstantInt::get(generator->get_context(),
+                                  llvm::APInt(1, 1, false));
+  } else if (value == TOKEN_FALSE) {
+    return llvm::ConstantInt::get(generator->get_context(),
+                                  llvm::APInt(1, 0, false));
+  }
+
+  if (is_float_literal(value)) {
+    std::string digits = value.back() == 'f' ? value.substr(0, value.size() - 1)
+                                             : value;
+
+    return llvm::ConstantFP::get(llvm_type_of(node.get()),
+                                 std::strtod(digits.c_str(), nullptr));
+  }
+
+  std::string digits;
+  if (integer_literal_type(value, &digits)) {
+    auto* type = llvm::cast<llvm::IntegerType>(llvm_type_of(node.get()));
+    return llvm::ConstantInt::get(type, digits, 10);
+  }
+
+  try {
+    int int_val = std::stoi(value);
+    return llvm::ConstantInt::get(llvm_type_of(node.get()), int_val, true);
+  } catch (const codegen_error&) {
+    throw;
+  } catch (...) {
+  }
+
+  if (value.front() == TOKEN_QUOTE && value.back() == TOKEN_QUOTE) {
+    std::string str_val = value.substr(1, value.size() - 2);
+
+    return generator->get_string_constant(str_val);
+  }
+
+  const codegen_binding* var = generator->get_current_scope()->get_value(value);
+  if (!var) {
+    throw codegen_error("undefined variable: " + value);
+  }
+
+  // defs are lowered to plain functions without an environment, constants and
+  // globals are the only values that can be shared between them
+  llvm::Function* owner = owning_function(var->value);
+
+  if (owner && owner != generator->get_builder().GetInsertBlock()->getParent()) {
+    throw codegen_error("cannot capture variable of enclosing function: " +
+                        value);
+  }
+
+  if (!var->is_mutable) {
+    return var->value;
+  }
+
+  return generator->get_builder().CreateLoad(var->slot_type, var->value,
+                                             value);
+}
+
+// binds a let or a parameter, only names that are assigned with `set`
+// somewhere in the enclosing function get a stack slot
+
+llvm::Value* codegen_visitor::bind_variable(const std::string& name,
+                                            llvm::Value* value) {
+  if (!assigned_names.count(name)) {
+    if (!value->hasName() && !llvm::isa<llvm::Constant>(value)) {
+      value->setName(name);
+    }
+
+    generator->get_current_scope()->set_value(name, value);
+    return value;
+  }
+
+  llvm::Function* func = generator->get_builder().GetInsertBlock()->getParent();
+  llvm::AllocaInst* alloca =
+      generator->create_entry_block_alloca(func, name, value->getType());
+
+  generator->get_builder().CreateStore(value, alloca);
+  generator->get_current_scope()->set_value(name, alloca, true);
+
+  return value;
+}
+
+// the free names of def bodies and the free ones assigned there, `bound` is
+// what the enclosing block has bound so far. a def only sees its own
+// bindings, so whatever else it mentions may be a top-level let
+
+void collect_def_names(const std::shared_ptr<typed_lisp::node>& node,
+                       std::unordered_set<std::string>* bound,
+                       std::unordered_set<std::string>& reads,
+                       std::unordered_set<std::string>& assigned) {
+  if (auto a = std::dynamic_pointer_cast<atom>(node)) {
+    if (bound && !bound->count(a->value)) reads.insert(a->value);
+    return;
+  }
+
+  auto list_node = std::dynamic_pointer_cast<typed_lisp::list>(node);
+
+  if (!list_node || list_node->children.empty()) return;
+
+  auto first =
+      std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[0]);
+  auto name_at = [&](size_t i) -> std::string {
+    auto name = i < list_node->children.size()
+                    ? std::dynamic_pointer_cast<atom>(list_node->children[i])
+                    : nullptr;
+    return name ? name->value : "";
+  };
+  const std::string head = first ? first->value : "";
+  auto& children = list_node->children;
+
+  if (head == TOKEN_DEF && children.size() > 4) {
+    std::unordered_set<std::string> own;
+    auto params = std::dynamic_pointer_cast<list>(children[4]);
+
+    for (size_t i = 0; params && i < params->children.size(); i += 3) {
+      if (auto param = std::dynamic_pointer_cast<atom>(params->children[i])) {
+        own.insert(param->value);
+      }
+    }
+
+    for (size_t i = 5; i < children.size(); ++i) {
+      collect_def_names(children[i], &own, reads, assigned);
+    }
+
+    return;
+  }
+
+  // outside of defs only the defs are looked at
+  if (!bound) {
+    for (const auto& child : children) {
+      collect_def_names(child, nullptr, reads, assigned);
+    }
+
+    return;
+  }
+
+  // a let binds for the rest of the block it is in
+  if (head == TOKEN_LET && children.size() == 5) {
+    collect_def_names(children[4], bound, reads, assigned);
+    bound->insert(name_at(1));
+    return;
+  }
+
+  if (head == TOKEN_SET && !bound->count(name_at(1))) {
+    assigned.insert(name_at(1));
+  }
+
+  // each branch is a block of its own, a loop body is one block with the
+  // index bound
+  std::unordered_set<std::string> block = *bound;
+
+  for (size_t i = 1; i < children.size(); ++i) {
+    if (head == TOKEN_IF) block = *bound;
+
+    if ((head == TOKEN_FOR || head == TOKEN_PARALLEL_FOR) && i == 6) {
+      block.insert(name_at(1));
+    }
+
+    collect_def_names(children[i], &block, reads, assigned);
+  }
+}
+
+void codegen_visitor::collect_def_names(
+    const std::shared_ptr<typed_lisp::node>& ast) {
+  def_reads.clear();
+  def_assigned.clear();
+  typed_lisp::collect_def_names(ast, nullptr, def_reads, def_assigned);
+}
+
+bool codegen_visitor::needs_global(const std::string& name,
+                                   llvm::Value* value) {
+  if (generator->get_current_scope() != generator->get_global_scope() ||
+      !def_reads.count(name)) {
+    return false;
+  }
+
+  return partitioned || !llvm::isa<llvm::Constant>(value) ||
+         assigned_names.count(name) || def_assigned.count(name);
+}
+
+// a top-level let read by defs, main stores the value before any def that
+// can see it is called. globals are private to the module unless partitions
+// share them
+
+llvm::Value* codegen_visitor::bind_global(const std::string& name,
+                                          llvm::Value* value) {
+  auto* constant = llvm::dyn_cast<llvm::Constant>(value);
+  auto* global = new llvm::GlobalVariable(
+      generator->get_module(), value->getType(), false,
+      partitioned ? llvm::GlobalValue::ExternalLinkage
+                  : llvm::GlobalValue::InternalLinkage,
+      constant ? constant : llvm::Constant::getNullValue(value->getType()),
+      name);
+
+  if (!constant) {
+    generator->get_builder().CreateStore(value, global);
+  }
+
+  generator->get_current_scope()->set_value(name, global, true,
+                                            value->getType());
+
+  return value;
+}
+
+// the global of a top-level let that main, lowered by another partition,
+// defines
+void codegen_visitor::declare_global(const std::shared_ptr<list>& let) {
+  auto name_node = std::dynamic_pointer_cast<atom>(let->children[1]);
+  llvm::Type* type = llvm_type_of(let.get());
+
+  auto* global = new llvm::GlobalVariable(
+      generator->get_module(), type, false, llvm::GlobalValue::ExternalLinkage,
+      nullptr, name_node->value);
+
+  generator->get_current_scope()->set_value(name_node->value, global, true,
+                                            type);
+}
+
+// collects the names targeted by `set` in a function body, nested defs are
+// lowered with their own set
+
+void collect_assigned_names(const std::shared_ptr<typed_lisp::node>& node,
+                            std::unordered_set<std::string>& names) {
+  auto list_node = std::dynamic_pointer_cast<typed_lisp::list>(node);
+
+  if (!list_node || list_node->children.empty()) return;
+
+  auto first =
+      std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[0]);
+
+  if (first && first->value == TOKEN_DEF) return;
+
+  if (first && first->value == TOKEN_SET && list_node->children.size() > 1) {
+    if (auto target = std::dynamic_pointer_cast<typed_lisp::atom>(
+            list_node->children[1])) {
+      names.insert(target->value);
+    }
+  }
+
+  for (const auto& child : list_node->children) {
+    collect_assigned_names(child, names);
+  }
+}
+
+llvm::Value* codegen_visitor::codegen_sequence(
+    const std::shared_ptr<list>& node, size_t begin, bool tail) {
+  if (begin >= node->children.size()) {
+    throw codegen_error("expected at least one expression");
+  }
+
+  llvm::Value* result = nullptr;
+  for (size_t i = begin; i < node->children.size(); ++i) {
+    result = codegen_node(node->children[i],
+                          tail && i + 1 == node->children.size());
+  }
+
+  return result;
+}
+
+// the length is the last member of an array value, after the data pointer or
+// after one pointer per field for a structure-of-arrays
+unsigned length_index(llvm::Value* array) {
+  return llvm::cast<llvm::StructType>(array->getType())->getNumElements() - 1;
+}
+
+// the record whose arrays use the structure-of-arrays layout, if any
+std::shared_ptr<struct_type> soa_record(const type_ptr& t) {
+  auto array = std::dynamic_pointer_cast<array_type>(t);
+  auto record =
+      array ? std::dynamic_pointer_cast<struct_type>(array->elem_type) : nullptr;
+
+  return record && record->soa ? record : nullptr;
+}
+
+// the length of an array value when it is a compile time constant, e.g. for
+// arrays made with a literal length or bound to a T[N] annotation
+llvm::ConstantInt* known_length(llvm::Value* array) {
+  unsigned index = length_index(array);
+
+  while (auto* insert = llvm::dyn_cast<llvm::InsertValueInst>(array)) {
+    if (insert->getIndices()[0] == index) {
+      return llvm::dyn_cast<llvm::ConstantInt>(
+          insert->getInsertedValueOperand());
+    }
+
+    array = insert->getAggregateOperand();
+  }
+
+  return nullptr;
+}
+
+bool is_length_of(llvm::Value* value, llvm::Value* array) {
+  auto* extract = llvm::dyn_cast<llvm::ExtractValueInst>(value);
+
+  return extract && extract->getAggregateOperand() == array &&
+         extract->getIndices()[0] == length_index(array);
+}
+
+llvm::Value* codegen_visitor::codegen_let(const std::shared_ptr<list>& node) {
+  if (node->children.size() != 5) {
+    throw codegen_error("invalid let expression");
+  }
+
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+  auto colon = std::dynamic_pointer_cast<atom>(node->children[2]);
+  auto type_node = std::dynamic_pointer_cast<atom>(node->children[3]);
+
+  if (!name_node || !colon || !type_node || colon->value != TOKEN_COLON) {
+    throw codegen_error("invalid let syntax");
+  }
+
+  llvm::Value* val = codegen_node(node->children[4]);
+
+  if (!val) {
+    throw codegen_error("invalid value in let expression");
+  }
+
+  if (val->getType() != llvm_type_of(node.get())) {
+    throw codegen_error("type mismatch in let expression: " + name_node->value);
+  }
+
+  // a T[N] annotation pins the length, checked here once so that accesses
+  // through the binding can rely on it. Literal lengths were already checked
+  // by the type checker, other lengths that fold to a constant still get the
+  // run time check
+  auto declared = std::dynamic_pointer_cast<array_type>(
+      parse_type(type_node->value));
+
+  if (declared && !declared->is_dynamic()) {
+    auto& builder = generator->get_builder();
+    llvm::ConstantInt* length = known_length(val);
+
+    if (!length || length->getZExtValue() != declared->size) {
+      llvm::Value* size = builder.getInt32(declared->size);
+      unsigned index = length_index(val);
+
+      emit_check(
+          builder.CreateICmpEQ(builder.CreateExtractValue(val, index), size),
+          "length");
+      val = builder.CreateInsertValue(val, size, index);
+    }
+  }
+
+  if (needs_global(name_node->value, val)) {
+    return bind_global(name_node->value, val);
+  }
+
+  return bind_variable(name_node->value, val);
+}
+
+llvm::Value* codegen_visitor::codegen_set(const std::shared_ptr<list>& node) {
+  if (node->children.size() != 3) {
+    throw codegen_error("invalid set expression");
+  }
+
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+
+  if (!name_node) {
+    throw codegen_error("invalid set syntax");
+  }
+
+  llvm::Value* val = codegen_node(node->children[2]);
+
+  if (!val) {
+    throw codegen_error("invalid value in set expression");
+  }
+
+  const codegen_binding* var =
+      generator->get_current_scope()->get_value(name_node->value);
+
+  if (!var) {
+    throw codegen_error("undefined variable: " + name_node->value);
+  }
+
+  llvm::Function* func = generator->get_builder().GetInsertBlock()->getParent();
+
+  llvm::Function* owner = owning_function(var->value);
+
+  if (!var->is_mutable || (owner && owner != func)) {
+    throw codegen_error("cannot assign variable of enclosing function: " +
+                        name_node->value);
+  }
+
+  // a parallel body sees the slots of its captures through its env, they are
+  // shared by every worker
+  if (!llvm::isa<llvm::AllocaInst>(var->value) &&
+      !llvm::isa<llvm::GlobalVariable>(var->value)) {
+    throw codegen_error("cannot assign variable captured by a parallel body: " +
+                        name_node->value);
+  }
+
+  generator->get_builder().CreateStore(val, var->value);
+
+  return val;
+}
+
+// in tail position every branch returns on its own, there is no merge block
+// and the returned value is only a placeholder
+
+llvm::Value* codegen_visitor::codegen_if(const std::shared_ptr<list>& node,
+                                         bool tail) {
+  if (node->children.size() != 4) {
+    throw codegen_error("invalid if expression");
+  }
+
+  auto& builder = generator->get_builder();
+  llvm::Value* cond_val = codegen_node(node->children[1]);
+
+  if (!cond_val) {
+    throw codegen_error("invalid condition in if expression");
+  }
+
+  llvm::Function* func = builder.GetInsertBlock()->getParent();
+
+  llvm::BasicBlock* then_bb =
+      llvm::BasicBlock::Create(generator->get_context(), "then", func);
+  llvm::BasicBlock* else_bb =
+      llvm::BasicBlock::Create(generator->get_context(), "else", func);
+  llvm::BasicBlock* merge_bb =
+      tail ? nullptr
+           : llvm::BasicBlock::Create(generator->get_context(), "ifcont", func);
+
+  builder.CreateCondBr(cond_val, then_bb, else_bb);
+
+  // for the builder we cannot access with getBasicBlockList, first create with
+  // BasicBlock::Create then insert into fns with Function::getEntryBlock()
+
+  // lets in a branch only dominate that branch, so each gets its own scope
+  auto prev_scope = generator->get_current_scope();
+
+  builder.SetInsertPoint(then_bb);
+  generator->set_current_scope(generator->create_new_scope());
+
+  llvm::Value* then_val = codegen_node(node->children[2], tail);
+  if (!then_val) {
+    throw codegen_error("invalid then branch in if expression");
+  }
+
+  if (tail) {
+    return_value(then_val);
+  } else {
+    builder.CreateBr(merge_bb);
+  }
+  then_bb = builder.GetInsertBlock();
+
+  builder.SetInsertPoint(else_bb);
+  generator->set_current_scope(prev_scope->create_child());
+
+  llvm::Value* else_val = codegen_node(node->children[3], tail);
+  if (!else_val) {
+    throw codegen_error("invalid else branch in if expression");
+  }
+
+  if (tail) {
+    return_value(else_val);
+  } else {
+    builder.CreateBr(merge_bb);
+  }
+  else_bb = builder.GetInsertBlock();
+
+  generator->set_current_scope(prev_scope);
+
+  if (tail) {
+    return llvm::UndefValue::get(func->getReturnType());
+  }
+
+  builder.SetInsertPoint(merge_bb);
+
+  llvm::PHINode* pn = builder.CreatePHI(llvm_type_of(node.get()), 2, "iftmp");
+
+  pn->addIncoming(then_val, then_bb);
+  pn->addIncoming(else_val, else_bb);
+
+  return pn;
+}
+
+// loops are lowered in the shape llvm's loop passes expect, a preheader that
+// only branches to the header, a header that tests the exit condition and a
+// single latch branching back to it. the body gets its own scope
+
+llvm::Value* codegen_visitor::codegen_while(const std::shared_ptr<list>& node) {
+  if (node->children.size() < 3) {
+    throw codegen_error("invalid while expression");
+  }
+
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  llvm::Function* func = builder.GetInsertBlock()->getParent();
+
+  llvm::BasicBlock* header_bb =
+      llvm::BasicBlock::Create(context, "while.cond", func);
+  llvm::BasicBlock* body_bb =
+      llvm::BasicBlock::Create(context, "while.body", func);
+  llvm::BasicBlock* exit_bb =
+      llvm::BasicBlock::Create(context, "while.end", func);
+
+  builder.CreateBr(header_bb);
+  builder.SetInsertPoint(header_bb);
+
+  llvm::Value* cond = codegen_node(node->children[1]);
+  builder.CreateCondBr(cond, body_bb, exit_bb);
+
+  auto prev_scope = generator->get_current_scope();
+
+  builder.SetInsertPoint(body_bb);
+  generator->set_current_scope(generator->create_new_scope());
+
+  codegen_sequence(node, 2);
+  builder.CreateBr(header_bb);
+
+  generator->set_current_scope(prev_scope);
+  builder.SetInsertPoint(exit_bb);
+
+  return builder.getInt32(0);
+}
+
+// (for i : int start end body...) runs the body for start <= i < end, the
+// induction variable is a phi in the header and is incremented in the latch.
+// the increment cannot overflow since i < end, so it is marked nsw
+
+llvm::Value* codegen_visitor::codegen_for(const std::shared_ptr<list>& node) {
+  if (node->children.size() < 7) {
+    throw codegen_error("invalid for expression");
+  }
+
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+
+  if (!name_node) {
+    throw codegen_error("invalid for syntax");
+  }
+
+  auto head = std::dynamic_pointer_cast<atom>(node->children[0]);
+
+  if (head->value == TOKEN_PARALLEL_FOR) {
+    return codegen_parallel_for(node);
+  }
+
+  llvm::Value* start = codegen_node(node->children[4]);
+  llvm::Value* end = codegen_node(node->children[5]);
+
+  auto* first = llvm::dyn_cast<llvm::ConstantInt>(start);
+  bool counted = first && !first->isNegative();
+  auto info = integer_type_info(type_of(node->children[4].get()));
+
+  emit_loop(start, end, info && !info->is_signed, name_node->value,
+            [&](llvm::Value* index) {
+              if (counted) {
+                loop_bounds.emplace_back(index, end);
+              }
+
+              bind_variable(name_node->value, index);
+              codegen_sequence(node, 6);
+
+              if (counted) {
+                loop_bounds.pop_back();
+              }
+            });
+
+  return generator->get_builder().getInt32(0);
+}
+
+// a loop counting from start up to end, `body` is lowered in a scope of its
+// own and gets the index
+
+void codegen_visitor::emit_loop(
+    llvm::Value* start, llvm::Value* end, bool is_unsigned,
+    const std::string& name,
+    const std::function<void(llvm::Value* index)>& body) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+
+  llvm::BasicBlock* preheader_bb = builder.GetInsertBlock();
+  llvm::Function* func = preheader_bb->getParent();
+
+  llvm::BasicBlock* header_bb =
+      llvm::BasicBlock::Create(context, "for.cond", func);
+  llvm::BasicBlock* body_bb = llvm::BasicBlock::Create(context, "for.body", func);
+  llvm::BasicBlock* latch_bb = llvm::BasicBlock::Create(context, "for.inc", func);
+  llvm::BasicBlock* exit_bb = llvm::BasicBlock::Create(context, "for.end", func);
+
+  builder.CreateBr(header_bb);
+  builder.SetInsertPoint(header_bb);
+
+  llvm::PHINode* index = builder.CreatePHI(start->getType(), 2);
+  index->addIncoming(start, preheader_bb);
+
+  llvm::Value* in_range = is_unsigned
+                              ? builder.CreateICmpULT(index, end, "for.cmp")
+                              : builder.CreateICmpSLT(index, end, "for.cmp");
+
+  builder.CreateCondBr(in_range, body_bb, exit_bb);
+
+  auto prev_scope = generator->get_current_scope();
+
+  builder.SetInsertPoint(body_bb);
+  generator->set_current_scope(generator->create_new_scope());
+
+  body(index);
+  builder.CreateBr(latch_bb);
+
+  builder.SetInsertPoint(latch_bb);
+  llvm::Value* one = llvm::ConstantInt::get(index->getType(), 1);
+  llvm::Value* next = is_unsigned
+                          ? builder.CreateNUWAdd(index, one, name + ".next")
+                          : builder.CreateNSWAdd(index, one, name + ".next");
+  index->addIncoming(next, latch_bb);
+  builder.CreateBr(header_bb);
+
+  generator->set_current_scope(prev_scope);
+  builder.SetInsertPoint(exit_bb);
+}
+
+// the names a parallel body reads from the enclosing function, mutable
+// variables are read through their stack slot but cannot be assigned.
+// constants and globals are reached from the body without a copy
+
+void collect_captures(const std::shared_ptr<typed_lisp::node>& node,
+                      const codegen_scope& scope, llvm::Function* parent,
+                      std::map<std::string, codegen_binding>& captures) {
+  if (auto a = std::dynamic_pointer_cast<atom>(node)) {
+    const codegen_binding* binding = scope.get_value(a->value);
+    llvm::Function* owner = binding ? owning_function(binding->value) : nullptr;
+
+    if (owner && owner != parent) {
+      throw codegen_error("cannot capture variable of enclosing function: " +
+                          a->value);
+    }
+
+    if (owner) {
+      captures.emplace(a->value, *binding);
+    }
+
+    return;
+  }
+
+  if (auto l = std::dynamic_pointer_cast<list>(node)) {
+    for (const auto& child : l->children) {
+      collect_captures(child, scope, parent, captures);
+    }
+  }
+}
+
+// outlines a loop over [begin, end) into `void body(i8* env, i32 lo, i32 hi)`
+// and hands it to the runtime. captured values are copied into an env struct
+// on the caller's stack and rebound under their names inside the body
+
+void codegen_visitor::emit_parallel_loop(
+    llvm::Value* begin, llvm::Value* end, const std::string& name,
+    const std::map<std::string, codegen_binding>& captures,
+    const std::function<void(llvm::Value* index)>& body) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  llvm::Function* parent = builder.GetInsertBlock()->getParent();
+
+  std::vector<llvm::Type*> field_types;
+  for (const auto& [capture, binding] : captures) {
+    field_types.push_back(binding.value->getType());
+  }
+
+  llvm::StructType* env_type = llvm::StructType::get(context, field_types);
+  llvm::Type* int8_ptr_type = builder.getInt8PtrTy();
+  llvm::Type* int32_type = builder.getInt32Ty();
+
+  llvm::Function* outlined = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getVoidTy(),
+                              {int8_ptr_type, int32_type, int32_type}, false),
+      llvm::Function::InternalLinkage, parent->getName() + ".parallel",
+      generator->get_module());
+
+  llvm::AllocaInst* env = generator->create_entry_block_alloca(
+      parent, name + ".env", env_type);
+
+  unsigned field = 0;
+  for (const auto& [capture, binding] : captures) {
+    builder.CreateStore(binding.value,
+                        builder.CreateStructGEP(env_type, env, field++));
+  }
+
+  // the body is lowered into the outlined function with the enclosing state
+  // put aside
+  auto saved_ip = builder.saveIP();
+  auto prev_scope = generator->get_current_scope();
+  auto prev_bounds = std::move(loop_bounds);
+  tail_target prev_def = current_def;
+  coroutine prev_coro = current_coro;
+
+  current_def = {};
+  current_coro = {};
+  loop_bounds.clear();
+
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", outlined));
+  generator->set_current_scope(generator->create_new_scope());
+
+  auto args = outlined->arg_begin();
+  llvm::Value* env_arg = builder.CreateBitCast(
+      &*args, env_type->getPointerTo(), "env");
+
+  field = 0;
+  for (const auto& [capture, binding] : captures) {
+    llvm::Value* value = builder.CreateLoad(
+        field_types[field], builder.CreateStructGEP(env_type, env_arg, field),
+        capture);
+    generator->get_current_scope()->set_value(
+        capture, value, binding.is_mutable, binding.slot_type);
+    ++field;
+  }
+
+  emit_loop(&*(args + 1), &*(args + 2), false, name, body);
+  builder.CreateRetVoid();
+
+  std::string message;
+  llvm::raw_string_ostream stream(message);
+
+  if (llvm::verifyFunction(*outlined, &stream)) {
+    throw codegen_error("invalid parallel body: " + stream.str());
+  }
+
+  current_def = prev_def;
+  current_coro = prev_coro;
+  loop_bounds = std::move(prev_bounds);
+  generator->set_current_scope(prev_scope);
+  builder.restoreIP(saved_ip);
+
+  builder.CreateCall(generator->get_intrinsic("tl_parallel_for"),
+                     {begin, end, builder.getInt32(0), outlined,
+                      builder.CreateBitCast(env, int8_ptr_type)});
+}
+
+// (parallel-for i : int start end body...) runs the iterations on the
+// runtime's workers, it yields 0 like for
+
+llvm::Value* codegen_visitor::codegen_parallel_for(
+    const std::shared_ptr<list>& node) {
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+
+  llvm::Value* start = codegen_node(node->children[4]);
+  llvm::Value* end = codegen_node(node->children[5]);
+
+  std::map<std::string, codegen_binding> captures;
+  for (size_t i = 6; i < node->children.size(); ++i) {
+    collect_captures(node->children[i], *generator->get_current_scope(),
+                     generator->get_builder().GetInsertBlock()->getParent(),
+                     captures);
+  }
+
+  emit_parallel_loop(start, end, name_node->value, captures,
+                     [&](llvm::Value* index) {
+                       bind_variable(name_node->value, index);
+                       codegen_sequence(node, 6);
+                     });
+
+  return generator->get_builder().getInt32(0);
+}
+
+// (parallel-map f xs) applies a def to every element into a new array
+llvm::Value* codegen_visitor::codegen_parallel_map(
+    const std::shared_ptr<list>& node) {
+  auto& builder = generator->get_builder();
+
+  if (node->children.size() != 3) {
+    throw codegen_error("parallel-map expects a def and an array");
+  }
+
+  auto fn = std::dynamic_pointer_cast<atom>(node->children[1]);
+  llvm::Function* callee =
+      fn ? generator->get_current_scope()->get_function(fn->value) : nullptr;
+
+  if (!callee || callee->arg_size() != 1) {
+    throw codegen_error("parallel-map expects a monomorphic def of one argument");
+  }
+
+  if (soa_record(type_of(node->children[2].get())) ||
+      soa_record(type_of(node.get()))) {
+    throw codegen_error("parallel-map over a structure-of-arrays");
+  }
+
+  llvm::Value* source = codegen_node(node->children[2]);
+  llvm::Value* length = builder.CreateExtractValue(source, 1, "len");
+  llvm::Type* elem_type = callee->getArg(0)->getType();
+  llvm::Type* result_type = callee->getReturnType();
+
+  llvm::Value* data = allocate_array(length, result_type);
+
+  std::map<std::string, codegen_binding> captures = {
+      {".source", {source, false}}, {".result", {data, false}}};
+
+  emit_parallel_loop(
+      builder.getInt32(0), length, "i", captures, [&](llvm::Value* index) {
+        auto scope = generator->get_current_scope();
+        llvm::Value* from = builder.CreateExtractValue(
+            scope->get_value(".source")->value, 0, "data");
+        llvm::Value* elem = builder.CreateLoad(
+            elem_type, builder.CreateInBoundsGEP(elem_type, from, index),
+            "elemtmp");
+        llvm::CallInst* call = builder.CreateCall(callee, {elem}, "calltmp");
+        call->setCallingConv(callee->getCallingConv());
+
+        builder.CreateStore(
+            call, builder.CreateInBoundsGEP(
+                      result_type, scope->get_value(".result")->value, index));
+      });
+
+  llvm::Value* array =
+      llvm::UndefValue::get(generator->get_array_type(result_type));
+  array = builder.CreateInsertValue(array, data, 0);
+
+  return builder.CreateInsertValue(array, length, 1, "array");
+}
+
+// branches to a trap when `ok` does not hold, failures are marked unlikely
+void codegen_visitor::emit_check(llvm::Value* ok, const std::string& name) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  llvm::Function* func = builder.GetInsertBlock()->getParent();
+
+  llvm::BasicBlock* fail_bb =
+      llvm::BasicBlock::Create(context, name + ".fail", func);
+  llvm::BasicBlock* cont_bb =
+      llvm::BasicBlock::Create(context, name + ".ok", func);
+
+  builder.CreateCondBr(ok, cont_bb, fail_bb,
+                       llvm::MDBuilder(context).createBranchWeights(2000, 1));
+
+  builder.SetInsertPoint(fail_bb);
+  builder.CreateCall(llvm::Intrinsic::getDeclaration(&generator->get_module(),
+                                                     llvm::Intrinsic::trap));
+  builder.CreateUnreachable();
+
+  builder.SetInsertPoint(cont_bb);
+}
+
+// checks an index against the length of an array, the check is left out when
+// the index is a constant below a known length, or the index of an enclosing
+// for loop that starts at a non-negative constant and ends at this array's
+// length or at a constant below its known length
+
+void codegen_visitor::check_index(llvm::Value* array, llvm::Value* index) {
+  auto& builder = generator->get_builder();
+  llvm::ConstantInt* length = known_length(array);
+
+  auto below = [&](llvm::Value* bound) {
+    auto* constant = llvm::dyn_cast<llvm::ConstantInt>(bound);
+
+    return is_length_of(bound, array) ||
+           (constant && length &&
+            constant->getSExtValue() <= length->getSExtValue());
+  };
+
+  bool proven = false;
+
+  if (auto* constant = llvm::dyn_cast<llvm::ConstantInt>(index)) {
+    proven = !constant->isNegative() && length &&
+             constant->getSExtValue() < length->getSExtValue();
+  }
+
+  for (const auto& [loop_index, end] : loop_bounds) {
+    proven = proven || (loop_index == index && below(end));
+  }
+
+  if (!proven) {
+    llvm::Value* size =
+        builder.CreateExtractValue(array, length_index(array), "len");
+    emit_check(builder.CreateICmpULT(index, size, "inbounds"), "bounds");
+  }
+}
+
+// mallocs `length` elements of `elem_type`, the byte count is computed in 64
+// bits and traps when it overflows or when malloc returns null
+llvm::Value* codegen_visitor::allocate_array(llvm::Value* length,
+                                             llvm::Type* elem_type) {
+  auto& builder = generator->get_builder();
+  llvm::Type* int64_type = builder.getInt64Ty();
+
+  llvm::Value* product = builder.CreateBinaryIntrinsic(
+      llvm::Intrinsic::umul_with_overflow,
+      builder.CreateZExt(length, int64_type, "len64"),
+      llvm::ConstantExpr::getSizeOf(elem_type));
+  emit_check(builder.CreateNot(builder.CreateExtractValue(product, 1)),
+             "size");
+
+  llvm::Value* raw = builder.CreateCall(
+      generator->get_intrinsic("malloc"),
+      {builder.CreateExtractValue(product, 0, "bytes")}, "raw");
+  emit_check(builder.CreateIsNotNull(raw, "allocated"), "malloc");
+
+  return builder.CreateBitCast(raw, elem_type->getPointerTo(), "data");
+}
+
+// mallocs `length` elements and fills them with `value`, arrays are never
+// freed
+llvm::Value* codegen_visitor::allocate_filled(llvm::Value* length,
+                                              llvm::Value* value) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  llvm::Type* elem_type = value->getType();
+  llvm::Type* int32_type = builder.getInt32Ty();
+
+  llvm::Value* data = allocate_array(length, elem_type);
+
+  llvm::BasicBlock* preheader_bb = builder.GetInsertBlock();
+  llvm::Function* func = preheader_bb->getParent();
+
+  llvm::BasicBlock* header_bb =
+      llvm::BasicBlock::Create(context, "fill.cond", func);
+  llvm::BasicBlock* body_bb = llvm::BasicBlock::Create(context, "fill.body", func);
+  llvm::BasicBlock* exit_bb = llvm::BasicBlock::Create(context, "fill.end", func);
+
+  builder.CreateBr(header_bb);
+  builder.SetInsertPoint(header_bb);
+
+  llvm::PHINode* index = builder.CreatePHI(int32_type, 2, "fill.index");
+  index->addIncoming(builder.getInt32(0), preheader_bb);
+
+  builder.CreateCondBr(builder.CreateICmpSLT(index, length), body_bb, exit_bb);
+
+  builder.SetInsertPoint(body_bb);
+  builder.CreateStore(value, builder.CreateInBoundsGEP(elem_type, data, index));
+  index->addIncoming(builder.CreateNSWAdd(index, builder.getInt32(1)), body_bb);
+  builder.CreateBr(header_bb);
+
+  builder.SetInsertPoint(exit_bb);
+
+  return data;
+}
+
+// a structure-of-arrays gets one allocation per field, filled with that field
+// of `init`
+llvm::Value* codegen_visitor::codegen_make_array(
+    llvm::Value* length, llvm::Value* init, const struct_type* soa) {
+  auto& builder = generator->get_builder();
+  auto* constant = llvm::dyn_cast<llvm::ConstantInt>(length);
+
+  if (constant && constant->isNegative()) {
+    throw codegen_error("negative array length");
+  } else if (!constant) {
+    emit_check(builder.CreateICmpSGE(length, builder.getInt32(0), "nonneg"),
+               "length");
+  }
+
+  std::vector<llvm::Value*> members;
+
+  if (soa) {
+    for (unsigned i = 0; i < soa->fields.size(); ++i) {
+      members.push_back(
+          allocate_filled(length, builder.CreateExtractValue(init, i)));
+    }
+  } else {
+    members.push_back(allocate_filled(length, init));
+  }
+
+  llvm::Type* array_type = soa ? generator->get_soa_array_type(*soa)
+                               : generator->get_array_type(init->getType());
+  llvm::Value* array = llvm::UndefValue::get(array_type);
+
+  for (unsigned i = 0; i < members.size(); ++i) {
+    array = builder.CreateInsertValue(array, members[i], i);
+  }
+
+  return builder.CreateInsertValue(array, length, members.size(), "array");
+}
+
+llvm::Value* codegen_visitor::codegen_array_op(
+    const std::shared_ptr<list>& node) {
+  auto op = std::dynamic_pointer_cast<atom>(node->children[0])->value;
+  auto& builder = generator->get_builder();
+
+  size_t arity = op == TOKEN_ARRAY_LEN ? 1 : op == TOKEN_ARRAY_SET ? 3 : 2;
+
+  if (node->children.size() != arity + 1) {
+    throw codegen_error("incorrect number of arguments passed to " + op);
+  }
+
+  std::vector<llvm::Value*> args;
+  for (size_t i = 1; i < node->children.size(); ++i) {
+    args.push_back(codegen_node(node->children[i]));
+  }
+
+  auto soa = soa_record(
+      type_of(op == TOKEN_MAKE_ARRAY ? node.get() : node->children[1].get()));
+
+  if (op == TOKEN_MAKE_ARRAY) {
+    return codegen_make_array(args[0], args[1], soa.get());
+  } else if (op == TOKEN_ARRAY_LEN) {
+    return builder.CreateExtractValue(args[0], length_index(args[0]), "len");
+  }
+
+  llvm::Value* array = args[0];
+  llvm::Value* index = args[1];
+  llvm::Type* elem_type = llvm_type_of(
+      op == TOKEN_ARRAY_GET ? node.get() : node->children[3].get());
+
+  check_index(array, index);
+
+  // a record in a structure-of-arrays is gathered from and scattered to its
+  // field arrays, fields that are never used are left to dead code removal
+  if (soa) {
+    auto* record_type = llvm::cast<llvm::StructType>(elem_type);
+    llvm::Value* record = llvm::UndefValue::get(record_type);
+
+    for (unsigned i = 0; i < soa->fields.size(); ++i) {
+      llvm::Type* field_type = record_type->getElementType(i);
+      llvm::Value* field = builder.CreateInBoundsGEP(
+          field_type, builder.CreateExtractValue(array, i), index,
+          soa->fields[i].first);
+
+      if (op == TOKEN_ARRAY_GET) {
+        record = builder.CreateInsertValue(
+            record, builder.CreateLoad(field_type, field), i);
+      } else {
+        builder.CreateStore(builder.CreateExtractValue(args[2], i), field);
+      }
+    }
+
+    return op == TOKEN_ARRAY_GET ? record : args[2];
+  }
+
+  llvm::Value* elem = builder.CreateInBoundsGEP(
+      elem_type, builder.CreateExtractValue(array, 0, "data"), index, "elem");
+
+  if (op == TOKEN_ARRAY_GET) {
+    return builder.CreateLoad(elem_type, elem, "elemtmp");
+  }
+
+  builder.CreateStore(args[2], elem);
+
+  return args[2];
+}
+
+// integers are extended by the signedness of the source and truncated,
+// conversions to and from floating point follow the integer's signedness and
+// a cast to bool compares against zero
+
+llvm::Value* codegen_visitor::codegen_cast(const std::shared_ptr<list>& node) {
+  auto& builder = generator->get_builder();
+  llvm::Value* value = codegen_node(node->children[2]);
+  llvm::Type* from = value->getType();
+  llvm::Type* to = llvm_type_of(node.get());
+
+  auto source = integer_type_info(type_of(node->children[2].get()));
+  auto target = integer_type_info(type_of(node.get()));
+  bool from_signed = source && source->is_signed;
+  bool to_signed = target && target->is_signed;
+
+  if (from == to) {
+    return value;
+  }
+
+  if (to->isIntegerTy(1)) {
+    return from->isFloatingPointTy()
+               ? builder.CreateFCmpUNE(value, llvm::ConstantFP::get(from, 0.0),
+                                       "casttmp")
+               : builder.CreateICmpNE(value, llvm::ConstantInt::get(from, 0),
+                                      "casttmp");
+  }
+
+  if (from->isIntegerTy() && to->isIntegerTy()) {
+    return builder.CreateIntCast(value, to, from_signed, "casttmp");
+  } else if (from->isIntegerTy()) {
+    return from_signed ? builder.CreateSIToFP(value, to, "casttmp")
+                       : builder.CreateUIToFP(value, to, "casttmp");
+  } else if (to->isIntegerTy()) {
+    return to_signed ? builder.CreateFPToSI(value, to, "casttmp")
+                     : builder.CreateFPToUI(value, to, "casttmp");
+  }
+
+  return builder.CreateFPCast(value, to, "casttmp");
+}
+
+// vectors are llvm fixed vectors, whole vector loads and stores go through
+// the element pointer with element alignment and check every lane's index
+
+llvm::Value* codegen_visitor::codegen_vector_op(
+    const std::shared_ptr<list>& node) {
+  auto op = std::dynamic_pointer_cast<atom>(node->children[0])->value;
+  auto& builder = generator->get_builder();
+
+  if (op == TOKEN_SPLAT) {
+    auto* type = llvm::cast<llvm::FixedVectorType>(llvm_type_of(node.get()));
+    return builder.CreateVectorSplat(type->getNumElements(),
+                                     codegen_node(node->children[2]), "splat");
+  }
+
+  if (op == TOKEN_LOAD_VEC || op == TOKEN_STORE_VEC) {
+    bool load = op == TOKEN_LOAD_VEC;
+    llvm::Value* array = codegen_node(node->children[load ? 2 : 1]);
+    llvm::Value* index = codegen_node(node->children[load ? 3 : 2]);
+    llvm::Value* value = load ? nullptr : codegen_node(node->children[3]);
+
+    auto* type = llvm::cast<llvm::FixedVectorType>(
+        load ? llvm_type_of(node.get()) : value->getType());
+    llvm::Type* elem_type = type->getElementType();
+    unsigned lanes = type->getNumElements();
+
+    auto* first = llvm::dyn_cast<llvm::ConstantInt>(index);
+    llvm::ConstantInt* length = known_length(array);
+
+    if (!first || first->isNegative() || !length ||
+        first->getSExtValue() + lanes > length->getSExtValue()) {
+      llvm::Value* size =
+          builder.CreateExtractValue(array, length_index(array), "len");
+      llvm::Value* count = builder.getInt32(lanes);
+
+      // index + lanes could overflow for an unchecked index, so the last
+      // valid start is compared against instead
+      llvm::Value* fits = builder.CreateAnd(
+          builder.CreateICmpSGE(size, count),
+          builder.CreateICmpSGE(index, builder.getInt32(0)));
+      llvm::Value* last = builder.CreateSub(size, count, "last");
+
+      emit_check(builder.CreateAnd(fits, builder.CreateICmpSLE(index, last),
+                                   "inbounds"),
+                 "bounds");
+    }
+
+    llvm::Value* elem = builder.CreateInBoundsGEP(
+        elem_type, builder.CreateExtractValue(array, 0, "data"), index);
+    llvm::Value* ptr = builder.CreateBitCast(elem, type->getPointerTo());
+    llvm::Align align(generator->get_module().getDataLayout().getABITypeAlign(
+        elem_type));
+
+    if (load) {
+      return builder.CreateAlignedLoad(type, ptr, align, "vec");
+    }
+
+    builder.CreateAlignedStore(value, ptr, align);
+
+    return value;
+  }
+
+  llvm::Value* vector = codegen_node(node->children[1]);
+  auto* type = llvm::cast<llvm::FixedVectorType>(vector->getType());
+  bool is_fp = type->getElementType()->isFloatingPointTy();
+
+  auto elem_info = [&]() {
+    auto vector_t = std::dynamic_pointer_cast<vector_type>(
+        type_of(node->children[1].get()));
+    return integer_type_info(vector_t ? vector_t->elem_type : nullptr);
+  };
+
+  if (op == TOKEN_LANE || op == TOKEN_WITH_LANE) {
+    llvm::Value* lane = codegen_node(node->children[2]);
+
+    if (auto* constant = llvm::dyn_cast<llvm::ConstantInt>(lane)) {
+      if (constant->getZExtValue() >= type->getNumElements()) {
+        throw codegen_error("lane " + std::to_string(constant->getSExtValue()) +
+                            " out of range for " +
+                            std::to_string(type->getNumElements()) + " lanes");
+      }
+    } else {
+      emit_check(builder.CreateICmpULT(
+                     lane, builder.getInt32(type->getNumElements()), "inlane"),
+                 "lane");
+    }
+
+    if (op == TOKEN_LANE) {
+      return builder.CreateExtractElement(vector, lane, "lane");
+    }
+
+    return builder.CreateInsertElement(
+        vector, codegen_node(node->children[3]), lane, "withlane");
+  }
+
+  if (op == TOKEN_SHUFFLE) {
+    llvm::Value* other = codegen_node(node->children[2]);
+    std::vector<int> mask;
+
+    for (size_t i = 3; i < node->children.size(); ++i) {
+      mask.push_back(
+          std::stoi(std::dynamic_pointer_cast<atom>(node->children[i])->value));
+    }
+
+    return builder.CreateShuffleVector(vector, other, mask, "shuffle");
+  }
+
+  if (op == TOKEN_REDUCE_ADD) {
+    return is_fp ? builder.CreateFAddReduce(
+                       llvm::ConstantFP::getNegativeZero(type->getElementType()),
+                       vector)
+                 : builder.CreateAddReduce(vector);
+  } else if (op == TOKEN_REDUCE_MUL) {
+    return is_fp ? builder.CreateFMulReduce(
+                       llvm::ConstantFP::get(type->getElementType(), 1.0),
+                       vector)
+                 : builder.CreateMulReduce(vector);
+  } else if (op == TOKEN_REDUCE_MIN) {
+    return is_fp ? builder.CreateFPMinReduce(vector)
+                 : builder.CreateIntMinReduce(vector, elem_info()->is_signed);
+  }
+
+  return is_fp ? builder.CreateFPMaxReduce(vector)
+               : builder.CreateIntMaxReduce(vector, elem_info()->is_signed);
+}
+
+// records are plain llvm struct values, a new record is built field by field
+// and `with` inserts one field into a copy
+
+llvm::Value* codegen_visitor::codegen_record(const std::shared_ptr<list>& node) {
+  auto op = std::dynamic_pointer_cast<atom>(node->children[0])->value;
+  auto& builder = generator->get_builder();
+
+  if (op == TOKEN_STRUCT) {
+    return builder.getInt32(0);
+  }
+
+  if (op == TOKEN_NEW) {
+    llvm::Value* record = llvm::UndefValue::get(llvm_type_of(node.get()));
+
+    for (size_t i = 2; i < node->children.size(); ++i) {
+      record = builder.CreateInsertValue(
+          record, codegen_node(node->children[i]), i - 2);
+    }
+
+    return record;
+  }
+
+  auto record_t =
+      std::dynamic_pointer_cast<struct_type>(type_of(node->children[1].get()));
+  auto field = std::dynamic_pointer_cast<atom>(node->children[2]);
+
+  if (!record_t || !field || !record_t->field_index(field->value)) {
+    throw codegen_error("invalid field access");
+  }
+
+  unsigned index = *record_t->field_index(field->value);
+  llvm::Value* record = codegen_node(node->children[1]);
+
+  if (op == TOKEN_FIELD) {
+    return builder.CreateExtractValue(record, index, field->value);
+  }
+
+  return builder.CreateInsertValue(record, codegen_node(node->children[3]),
+                                   index);
+}
+
+// `and` and `or` only evaluate their right operand when the left one does not
+// decide the result already, no profile data is collected so the branches
+// carry no weights
+
+llvm::Value* codegen_visitor::codegen_logical(const std::shared_ptr<list>& node) {
+  auto op = std::dynamic_pointer_cast<atom>(node->children[0])->value;
+
+  if (node->children.size() != 3) {
+    throw codegen_error("logical operator expects two operands: " + op);
+  }
+
+  auto& builder = generator->get_builder();
+  bool is_and = op == TOKEN_AND;
+
+  llvm::Value* lhs = codegen_node(node->children[1]);
+  llvm::BasicBlock* lhs_bb = builder.GetInsertBlock();
+  llvm::Function* func = lhs_bb->getParent();
+
+  llvm::BasicBlock* rhs_bb = llvm::BasicBlock::Create(
+      generator->get_context(), is_and ? "and.rhs" : "or.rhs", func);
+  llvm::BasicBlock* merge_bb = llvm::BasicBlock::Create(
+      generator->get_context(), is_and ? "and.end" : "or.end", func);
+
+  if (is_and) {
+    builder.CreateCondBr(lhs, rhs_bb, merge_bb);
+  } else {
+    builder.CreateCondBr(lhs, merge_bb, rhs_bb);
+  }
+
+  // like an if branch, the right operand may not run so it gets its own scope
+  auto prev_scope = generator->get_current_scope();
+
+  builder.SetInsertPoint(rhs_bb);
+  generator->set_current_scope(generator->create_new_scope());
+
+  llvm::Value* rhs = codegen_node(node->children[2]);
+
+  builder.CreateBr(merge_bb);
+  rhs_bb = builder.GetInsertBlock();
+
+  generator->set_current_scope(prev_scope);
+  builder.SetInsertPoint(merge_bb);
+
+  llvm::PHINode* pn =
+      builder.CreatePHI(builder.getInt1Ty(), 2, is_and ? "andtmp" : "ortmp");
+
+  pn->addIncoming(builder.getInt1(!is_and), lhs_bb);
+  pn->addIncoming(rhs, rhs_bb);
+
+  return pn;
+}
+
+// creates the prototype of a def and binds it in the current scope, a def
+// declared ahead of time (see declare_top_level_defs) is only bound again
+
+llvm::Function* codegen_visitor::declare_def(const std::shared_ptr<list>& node) {
+  if (node->children.size() < 6) {
+    throw codegen_error("invalid def expression");
+  }
+
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+  auto colon = std::dynamic_pointer_cast<atom>(node->children[2]);
+  auto ret_type_node = std::dynamic_pointer_cast<atom>(node->children[3]);
+  auto params_node = std::dynamic_pointer_cast<list>(node->children[4]);
+
+  if (!name_node || !colon || !ret_type_node || !params_node ||
+      colon->value != TOKEN_COLON) {
+    throw codegen_error("invalid def syntax");
+  }
+
+  type_ptr fn_type = type_of(node.get());
+
+  if (!fn_type->free_vars().empty()) {
+    generator->get_current_scope()->set_generic(name_node->value, node);
+    generic_scopes[node.get()] = generator->get_current_scope();
+    return nullptr;
+  }
+
+  auto declared = declared_defs.find(node.get());
+
+  if (declared != declared_defs.end()) {
+    generator->get_current_scope()->set_function(name_node->value,
+                                                 declared->second);
+    return declared->second;
+  }
+
+  llvm::Function* func = create_prototype(node, fn_type, name_node->value,
+                                          llvm::Function::ExternalLinkage);
+
+  generator->get_current_scope()->set_function(name_node->value, func);
+
+  // a def nested in a specialization gets a prototype per specialization
+  if (type_bindings.empty()) {
+    declared_defs[node.get()] = func;
+  }
+
+  return func;
+}
+
+llvm::Function* codegen_visitor::create_prototype(
+    const std::shared_ptr<list>& node, const type_ptr& fn_type,
+    const std::string& name, llvm::GlobalValue::LinkageTypes linkage) {
+  auto params_node = std::dynamic_pointer_cast<list>(node->children[4]);
+  std::vector<param_info> params;
+
+  for (size_t i = 0; i + 2 < params_node->children.size(); i += 3) {
+    auto param_name = std::dynamic_pointer_cast<atom>(params_node->children[i]);
+    auto param_type =
+        std::dynamic_pointer_cast<atom>(params_node->children[i + 2]);
+
+    if (!param_name || !param_type) {
+      throw codegen_error("invalid parameter in def: " + name);
+    }
+
+    params.push_back({param_name->value, param_type->value});
+  }
+
+  auto type_info = generator->get_function_type_info(fn_type, params.size());
+
+  llvm::Function* func =
+      llvm::Function::Create(type_info.create_function_type(), linkage, name,
+                             generator->get_module());
+
+  unsigned idx = 0;
+  for (auto& arg : func->args()) {
+    arg.setName(params[idx++].name);
+  }
+
+  return func;
+}
+
+llvm::Value* codegen_visitor::codegen_def(const std::shared_ptr<list>& node) {
+  // bound before lowering the body so that the def can call itself
+  llvm::Function* func = declare_def(node);
+
+  // polymorphic defs are only lowered per call site, see specialize
+  if (!func || external_defs.count(node.get())) {
+    return func;
+  }
+
+  define_def(node, func);
+
+  return func;
+}
+
+void codegen_visitor::define_def(const std::shared_ptr<list>& node,
+                                 llvm::Function* func) {
+  auto name_node = std::dynamic_pointer_cast<atom>(node->children[1]);
+  auto& builder = generator->get_builder();
+  auto saved_ip = builder.saveIP();
+  auto prev_scope = generator->get_current_scope();
+
+  llvm::BasicBlock* entry_bb =
+      llvm::BasicBlock::Create(generator->get_context(), "entry", func);
+  llvm::BasicBlock* header_bb =
+      llvm::BasicBlock::Create(generator->get_context(), "tailrecurse", func);
+
+  auto async = async_result(node);
+  tail_target prev_def = current_def;
+  coroutine prev_coro = current_coro;
+
+  builder.SetInsertPoint(entry_bb);
+
+  // an async def is a coroutine, self calls create a new one instead of
+  // jumping back to the header
+  if (async) {
+    begin_coroutine(func, generator->get_llvm_type(async->value_type));
+  } else {
+    current_coro = {};
+  }
+
+  llvm::BasicBlock* preheader_bb = builder.GetInsertBlock();
+  builder.CreateBr(header_bb);
+  builder.SetInsertPoint(header_bb);
+
+  current_def = {async ? nullptr : func, header_bb, {}};
+
+  auto function_scope = generator->create_new_scope();
+  generator->set_current_scope(function_scope);
+
+  std::unordered_set<std::string> prev_assigned;
+  std::swap(prev_assigned, assigned_names);
+
+  for (size_t i = 5; i < node->children.size(); ++i) {
+    collect_assigned_names(node->children[i], assigned_names);
+  }
+
+  for (auto& arg : func->args()) {
+    llvm::PHINode* phi = builder.CreatePHI(arg.getType(), 2);
+    phi->addIncoming(&arg, preheader_bb);
+
+    current_def.params.push_back(phi);
+    bind_variable(arg.getName().str(), phi);
+  }
+
+  llvm::Value* body_val = codegen_sequence(node, 5, !async);
+
+  if (!body_val) {
+    func->eraseFromParent();
+    throw codegen_error("invalid function body");
+  }
+
+  if (async) {
+    end_coroutine(body_val);
+  } else {
+    return_value(body_val);
+  }
+
+  // without a self tail call the loop header is folded back into the entry
+  if (header_bb->hasNPredecessors(1)) {
+    for (auto* phi : current_def.params) {
+      llvm::Value* arg = phi->getIncomingValue(0);
+      phi->replaceAllUsesWith(arg);
+      phi->eraseFromParent();
+    }
+
+    llvm::MergeBlockIntoPredecessor(header_bb);
+  }
+
+  std::string message;
+  llvm::raw_string_ostream stream(message);
+
+  if (llvm::verifyFunction(*func, &stream)) {
+    throw codegen_error("invalid function " + name_node->value + ": " +
+                        stream.str());
+  }
+
+  current_def = prev_def;
+  current_coro = prev_coro;
+  assigned_names = std::move(prev_assigned);
+  generator->set_current_scope(prev_scope);
+  builder.restoreIP(saved_ip);
+}
+
+// the async<T> returned by a def after all of its parameters, if any
+std::shared_ptr<async_type> codegen_visitor::async_result(
+    const std::shared_ptr<list>& def) {
+  auto params = std::dynamic_pointer_cast<list>(def->children[4]);
+  type_ptr t = type_of(def.get());
+
+  for (size_t i = 0; t && i + 2 < params->children.size(); i += 3) {
+    auto fn = std::dynamic_pointer_cast<func_type>(t);
+    t = fn ? fn->ret_type : nullptr;
+  }
+
+  return std::dynamic_pointer_cast<async_type>(t);
+}
+
+// every coroutine frame holds a promise { i8* waiter, T value }, the waiter
+// is the coroutine awaiting it and is scheduled once the value is stored
+llvm::StructType* codegen_visitor::promise_type(llvm::Type* value_type) {
+  auto& builder = generator->get_builder();
+  return llvm::StructType::get(generator->get_context(),
+                               {builder.getInt8PtrTy(), value_type});
+}
+
+llvm::Value* codegen_visitor::promise_of(llvm::Value* handle,
+                                         llvm::StructType* type) {
+  auto& builder = generator->get_builder();
+  auto& module = generator->get_module();
+  unsigned align = module.getDataLayout().getABITypeAlign(type).value();
+
+  llvm::Value* promise = builder.CreateCall(
+      llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::coro_promise),
+      {handle, builder.getInt32(align), builder.getFalse()});
+
+  return builder.CreateBitCast(promise, type->getPointerTo(), "promise");
+}
+
+// the frame comes from malloc unless coro.alloc says the caller provides the
+// storage, which is how frames that never outlive their caller are elided
+// onto its stack
+
+void codegen_visitor::begin_coroutine(llvm::Function* func,
+                                      llvm::Type* value_type) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  auto& module = generator->get_module();
+  auto intrinsic = [&](llvm::Intrinsic::ID id,
+                       llvm::ArrayRef<llvm::Type*> types = {}) {
+    return llvm::Intrinsic::getDeclaration(&module, id, types);
+  };
+
+#if LLVM_VERSION_MAJOR >= 15
+  func->addFnAttr(llvm::Attribute::PresplitCoroutine);
+#else
+  func->addFnAttr("coroutine.presplit", "0");
+#endif
+
+  llvm::StructType* type = promise_type(value_type);
+  llvm::AllocaInst* promise = builder.CreateAlloca(type, nullptr, "promise");
+  unsigned align = module.getDataLayout().getABITypeAlign(type).value();
+
+  builder.CreateStore(llvm::Constant::getNullValue(builder.getInt8PtrTy()),
+                      builder.CreateStructGEP(type, promise, 0));
+
+  llvm::Value* null = llvm::Constant::getNullValue(builder.getInt8PtrTy());
+  llvm::Value* id = builder.CreateCall(
+      intrinsic(llvm::Intrinsic::coro_id),
+      {builder.getInt32(align),
+       builder.CreateBitCast(promise, builder.getInt8PtrTy()), null, null},
+      "id");
+
+  llvm::BasicBlock* entry_bb = builder.GetInsertBlock();
+  llvm::BasicBlock* alloc_bb =
+      llvm::BasicBlock::Create(context, "coro.alloc", func);
+  llvm::BasicBlock* begin_bb =
+      llvm::BasicBlock::Create(context, "coro.begin", func);
+
+  builder.CreateCondBr(
+      builder.CreateCall(intrinsic(llvm::Intrinsic::coro_alloc), {id}),
+      alloc_bb, begin_bb);
+
+  builder.SetInsertPoint(alloc_bb);
+  llvm::Value* size = builder.CreateCall(
+      intrinsic(llvm::Intrinsic::coro_size, {builder.getInt64Ty()}));
+  llvm::Value* memory =
+      builder.CreateCall(generator->get_intrinsic("malloc"), {size}, "frame");
+  builder.CreateBr(begin_bb);
+
+  builder.SetInsertPoint(begin_bb);
+  llvm::PHINode* frame = builder.CreatePHI(builder.getInt8PtrTy(), 2);
+  frame->addIncoming(null, entry_bb);
+  frame->addIncoming(memory, alloc_bb);
+
+  llvm::Value* handle = builder.CreateCall(
+      intrinsic(llvm::Intrinsic::coro_begin), {id, frame}, "handle");
+
+  current_coro = {id,
+                  handle,
+                  promise,
+                  type,
+                  llvm::BasicBlock::Create(context, "coro.cleanup", func),
+                  llvm::BasicBlock::Create(context, "coro.suspend", func)};
+
+  // the suspend block ends the ramp, the first call returns the handle
+  builder.SetInsertPoint(current_coro.suspend);
+  builder.CreateCall(intrinsic(llvm::Intrinsic::coro_end),
+                     {handle, builder.getFalse()});
+  builder.CreateRet(handle);
+
+  builder.SetInsertPoint(current_coro.cleanup);
+  builder.CreateCall(generator->get_intrinsic("free"),
+                     {builder.CreateCall(intrinsic(llvm::Intrinsic::coro_free),
+                                         {id, handle}, "mem")});
+  builder.CreateBr(current_coro.suspend);
+
+  builder.SetInsertPoint(begin_bb);
+}
+
+// stores the value, hands the waiter back to the event loop and parks at the
+// final suspend point until the awaiting side destroys the frame
+void codegen_visitor::end_coroutine(llvm::Value* value) {
+  auto& builder = generator->get_builder();
+  auto* type = current_coro.promise_type;
+
+  builder.CreateStore(value,
+                      builder.CreateStructGEP(type, current_coro.promise, 1));
+
+  llvm::Value* waiter = builder.CreateLoad(
+      builder.getInt8PtrTy(),
+      builder.CreateStructGEP(type, current_coro.promise, 0), "waiter");
+  builder.CreateCall(generator->get_intrinsic("tl_loop_ready"), {waiter});
+
+  emit_suspend(true);
+}
+
+// resuming continues after the suspend point, destroying goes to cleanup. a
+// coroutine is never resumed from its final suspend point
+void codegen_visitor::emit_suspend(bool final) {
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  llvm::Function* func = builder.GetInsertBlock()->getParent();
+
+  llvm::Value* state = builder.CreateCall(
+      llvm::Intrinsic::getDeclaration(&generator->get_module(),
+                                      llvm::Intrinsic::coro_suspend),
+      {llvm::ConstantTokenNone::get(context), builder.getInt1(final)},
+      "state");
+
+  llvm::BasicBlock* resume_bb = llvm::BasicBlock::Create(
+      context, final ? "coro.final" : "coro.resume", func);
+
+  llvm::SwitchInst* dispatch =
+      builder.CreateSwitch(state, current_coro.suspend, 2);
+  dispatch->addCase(builder.getInt8(0), resume_bb);
+  dispatch->addCase(builder.getInt8(1), current_coro.cleanup);
+
+  builder.SetInsertPoint(resume_bb);
+
+  if (final) {
+    builder.CreateUnreachable();
+  }
+}
+
+// await takes the value out of a finished coroutine and destroys its frame.
+// inside an async def an unfinished one gets this coroutine as its waiter
+// and this one suspends, elsewhere the event loop runs until it is done
+
+llvm::Value* codegen_visitor::codegen_await(const std::shared_ptr<list>& node) {
+  auto head = std::dynamic_pointer_cast<atom>(node->children[0]);
+  auto& builder = generator->get_builder();
+  auto& context = generator->get_context();
+  auto& module = generator->get_module();
+
+  if (head->value == TOKEN_SLEEP) {
+    if (!current_coro.handle) {
+      throw codegen_error("sleep outside of an async def");
+    }
+
+    builder.CreateCall(generator->get_intrinsic("tl_loop_sleep"),
+                       {current_coro.handle, codegen_node(node->children[1])});
+    emit_suspend(false);
+
+    return builder.getInt32(0);
+  }
+
+  llvm::Value* handle = codegen_node(node->children[1]);
+  llvm::StructType* type = promise_type(llvm_type_of(node.get()));
+
+  if (current_coro.handle) {
+    llvm::Function* func = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* wait_bb =
+        llvm::BasicBlock::Create(context, "await.wait", func);
+    llvm::BasicBlock* ready_bb =
+        llvm::BasicBlock::Create(context, "await.ready", func);
+
+    llvm::Value* done = builder.CreateCall(
+        llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::coro_done),
+        {handle}, "done");
+    builder.CreateCondBr(done, ready_bb, wait_bb);
+
+    builder.SetInsertPoint(wait_bb);
+    builder.CreateStore(current_coro.handle,
+                        builder.CreateStructGEP(type, promise_of(handle, type), 0));
+    emit_suspend(false);
+    builder.CreateBr(ready_bb);
+
+    builder.SetInsertPoint(ready_bb);
+  } else {
+    builder.CreateCall(generator->get_intrinsic("tl_loop_run"), {handle});
+  }
+
+  llvm::Value* value = builder.CreateLoad(
+      type->getElementType(1),
+      builder.CreateStructGEP(type, promise_of(handle, type), 1), "awaittmp");
+
+  builder.CreateCall(
+      llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::coro_destroy),
+      {handle});
+
+  return value;
+}
+
+// binds the type variables of `generic` by matching it against the concrete
+// type `concrete`, fails when the shapes disagree or a variable would need two
+// different types
+
+bool match_types(const type_ptr& generic, const type_ptr& concrete,
+                 std::unordered_map<int, type_ptr>& bindings) {
+  if (auto var = std::dynamic_pointer_cast<var_type>(generic)) {
+    auto [it, inserted] = bindings.emplace(var->id, concrete);
+    return inserted || it->second->to_string() == concrete->to_string();
+  }
+
+  if (auto fn = std::dynamic_pointer_cast<func_type>(generic)) {
+    auto other = std::dynamic_pointer_cast<func_type>(concrete);
+
+    return other && match_types(fn->arg_type, other->arg_type, bindings) &&
+           match_types(fn->ret_type, other->ret_type, bindings);
+  }
 
-  scope->define_type(
-      TOKEN_ADD,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, int_t)));
-  scope->define_type(
-      TOKEN_SUB,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, int_t)));
-  scope->define_type(
-      TOKEN_MUL,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, int_t)));
-  scope->define_type(
-      TOKEN_DIV,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, int_t)));
+  if (auto array = std::dynamic_pointer_cast<array_type>(generic)) {
+    auto other = std::dynamic_pointer_cast<array_type>(concrete);
 
-  scope->define_type(
-      TOKEN_EQ,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, bool_t)));
-  scope->define_type(
-      TOKEN_GT,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, bool_t)));
-  scope->define_type(
-      TOKEN_LT,
-      ty.make_function_type(int_t, ty.make_function_type(int_t, bool_t)));
+    return other && (array->is_dynamic() || array->size == other->size) &&
+           match_types(array->elem_type, other->elem_type, bindings);
+  }
+
+  return generic->to_string() == concrete->to_string();
 }
 
-class llvm_codegen;
+// lowers a polymorphic def once for every distinct set of concrete types it is
+// called with, the specialization is private to the module and named after
+// the def and its type arguments, e.g. id.int
 
-class codegen_error : public std::runtime_error {
- public:
-  explicit codegen_error(const std::string& message)
-      : std::runtime_error(message) {}
-};
+llvm::Function* codegen_visitor::specialize(const std::shared_ptr<list>& def,
+                                            const std::shared_ptr<list>& call) {
+  type_ptr concrete = type_of(call.get());
 
-class codegen_scope : public std::enable_shared_from_this<codegen_scope> {
- private:
-  std::shared_ptr<codegen_scope> parent;
-  std::unordered_map<std::string, llvm::AllocaInst*> value_map;
-  std::unordered_map<std::string, llvm::Function*> function_map;
+  for (size_t i = call->children.size() - 1; i >= 1; --i) {
+    concrete = std::make_shared<func_type>(type_of(call->children[i].get()),
+                                           concrete);
+  }
 
- public:
-  explicit codegen_scope(std::shared_ptr<codegen_scope> p = nullptr)
-      : parent(p) {}
+  auto name_node = std::dynamic_pointer_cast<atom>(def->children[1]);
+  type_ptr generic = type_of(def.get());
+  std::unordered_map<int, type_ptr> bindings;
 
-  void set_value(const std::string& name, llvm::AllocaInst* value) {
-    value_map[name] = value;
+  if (!match_types(generic, concrete, bindings) ||
+      !concrete->free_vars().empty()) {
+    throw codegen_error("cannot specialize " + name_node->value + " at " +
+                        concrete->to_string());
   }
 
-  void set_function(const std::string& name, llvm::Function* func) {
-    function_map[name] = func;
+  auto key = std::make_pair(def.get(), concrete->to_string());
+  auto cached = specializations.find(key);
+
+  if (cached != specializations.end()) {
+    return cached->second;
   }
 
-  llvm::AllocaInst* get_value(const std::string& name) const {
-    auto it = value_map.find(name);
-    if (it != value_map.end()) {
-      return it->second;
+  std::vector<int> vars = generic->free_vars();
+  std::sort(vars.begin(), vars.end());
+  vars.erase(std::unique(vars.begin(), vars.end()), vars.end());
+
+  std::string name = name_node->value;
+  for (int var : vars) {
+    name += "." + bindings[var]->to_string();
+  }
+
+  llvm::Function* func = create_prototype(def, concrete, name,
+                                          llvm::Function::InternalLinkage);
+  specializations[key] = func;
+
+  // the body is lowered where the def was written, under the call site's types
+  auto prev_bindings = std::move(type_bindings);
+  auto prev_scope = generator->get_current_scope();
+
+  for (auto& [var, t] : prev_bindings) {
+    bindings.emplace(var, t);
+  }
+
+  type_bindings = std::move(bindings);
+  generator->set_current_scope(generic_scopes.at(def.get()));
+
+  define_def(def, func);
+
+  generator->set_current_scope(prev_scope);
+  type_bindings = std::move(prev_bindings);
+
+  return func;
+}
+
+// returns from the def being lowered unless a tail call already left the block
+void codegen_visitor::return_value(llvm::Value* value) {
+  auto& builder = generator->get_builder();
+
+  if (!builder.GetInsertBlock()->getTerminator()) {
+    builder.CreateRet(value);
+  }
+}
+
+// a self call in tail position becomes a jump back to the loop header, other
+// tail calls are marked musttail when the prototypes allow it and tail
+// otherwise, locals are never passed by address so neither can see the
+// caller's frame
+
+llvm::Value* codegen_visitor::codegen_call(const std::shared_ptr<list>& node,
+                                           bool tail) {
+  auto fn = std::dynamic_pointer_cast<atom>(node->children[0]);
+
+  if (!fn) {
+    throw codegen_error("first element of list must be an atom");
+  }
+
+  if (fn->value == TOKEN_AND || fn->value == TOKEN_OR) {
+    return codegen_logical(node);
+  }
+
+  if (fn->value == TOKEN_MAKE_ARRAY || fn->value == TOKEN_ARRAY_GET ||
+      fn->value == TOKEN_ARRAY_SET || fn->value == TOKEN_ARRAY_LEN) {
+    return codegen_array_op(node);
+  }
+
+  if (is_numeric_op(fn->value)) {
+    if (node->children.size() != 3) {
+      throw codegen_error("binary operator expects two operands: " +
+                          fn->value);
     }
 
-    if (parent) {
-      return parent->get_value(name);
+    llvm::Value* lhs = codegen_node(node->children[1]);
+    llvm::Value* rhs = codegen_node(node->children[2]);
+
+    type_ptr operand_t = type_of(node->children[1].get());
+
+    if (auto vector = std::dynamic_pointer_cast<vector_type>(operand_t)) {
+      operand_t = vector->elem_type;
     }
 
-    return nullptr;
+    auto info = integer_type_info(operand_t);
+
+    return codegen_binary_op(fn->value, info && !info->is_signed, lhs, rhs);
   }
 
-  llvm::Function* get_function(const std::string& name) const {
-    auto it = function_map.find(name);
-    if (it != function_map.end()) {
-      return it->second;
-    }
+  llvm::Function* callee =
+      generator->get_current_scope()->get_function(fn->value);
 
-    if (parent) {
-      return parent->get_function(name);
+  if (!callee) {
+    if (auto generic = generator->get_current_scope()->get_generic(fn->value)) {
+      callee = specialize(generic, node);
     }
+  }
 
-    return nullptr;
+  if (!callee) {
+    callee = generator->get_intrinsic(fn->value);
   }
 
-  std::shared_ptr<codegen_scope> create_child() {
-    return std::make_shared<codegen_scope>(shared_from_this());
+  if (!callee) {
+    throw codegen_error("unknown function: " + fn->value);
   }
-};
 
-struct llvm_type_mapping {
-  std::unordered_map<std::string, llvm::Type*> type_map;
+  size_t arg_count = node->children.size() - 1;
 
-  llvm::Type* get_type(llvm::LLVMContext& context, const std::string& name) {
-    auto it = type_map.find(name);
-    if (it != type_map.end()) {
-      return it->second;
-    }
+  if (callee->isVarArg() ? arg_count < callee->arg_size()
+                         : arg_count != callee->arg_size()) {
+    throw codegen_error("incorrect number of arguments passed to function: " +
+                        fn->value);
+  }
 
-    if (name == TYPE_INT) {
-      auto result = llvm::Type::getInt32Ty(context);
-      type_map[name] = result;
-      return result;
-    } else if (name == TYPE_BOOL) {
-      auto result = llvm::Type::getInt1Ty(context);
-      type_map[name] = result;
-      return result;
-    } else if (name == "void") {
-      auto result = llvm::Type::getVoidTy(context);
-      type_map[name] = result;
-      return result;
-    } else if (name == TYPE_STRING) {
-      auto result = llvm::Type::getInt8PtrTy(context);
-      type_map[name] = result;
-      return result;
-    } else if (name == TYPE_FLOAT) {
-      auto result = llvm::Type::getFloatTy(context);
-      type_map[name] = result;
-      return result;
-    } else if (name == TYPE_DOUBLE) {
-      auto result = llvm::Type::getDoubleTy(context);
-      type_map[name] = result;
-      return result;
+  std::vector<llvm::Value*> arg_values;
+  for (size_t i = 1; i < node->children.size(); ++i) {
+    arg_values.push_back(codegen_node(node->children[i]));
+  }
+
+  auto& builder = generator->get_builder();
+
+  if (tail && callee == current_def.function) {
+    for (size_t i = 0; i < arg_values.size(); ++i) {
+      current_def.params[i]->addIncoming(arg_values[i],
+                                         builder.GetInsertBlock());
     }
 
-    throw codegen_error("unknown type: " + name);
+    builder.CreateBr(current_def.header);
+    return llvm::UndefValue::get(callee->getReturnType());
   }
-};
 
-struct function_type_info {
-  llvm::Type* return_type;
-  std::vector<llvm::Type*> param_types;
+  llvm::CallInst* call = builder.CreateCall(callee, arg_values, "calltmp");
+  call->setCallingConv(callee->getCallingConv());
 
-  llvm::FunctionType* create_function_type() const {
-    return llvm::FunctionType::get(return_type, param_types, false);
+  if (tail && current_def.function) {
+    llvm::Function* caller = current_def.function;
+
+    bool same_prototype =
+        !callee->isVarArg() &&
+        callee->getFunctionType() == caller->getFunctionType() &&
+        callee->getCallingConv() == caller->getCallingConv();
+
+    call->setTailCallKind(same_prototype ? llvm::CallInst::TCK_MustTail
+                                         : llvm::CallInst::TCK_Tail);
+
+    if (same_prototype) {
+      builder.CreateRet(call);
+    }
   }
-};
 
-class node_codegen {
- public:
-  virtual ~node_codegen() = default;
-  virtual llvm::Value* codegen(llvm_codegen& generator) = 0;
-};
+  return call;
+}
 
-class atom_codegen : public node_codegen {
- private:
-  std::string value;
+llvm::Value* codegen_visitor::codegen_binary_op(const std::string& op,
+                                                bool is_unsigned,
+                                                llvm::Value* l,
+                                                llvm::Value* r) {
+  if (!l || !r) {
+    throw codegen_error("invalid operands for binary operator");
+  }
 
- public:
-  explicit atom_codegen(std::string val) : value(std::move(val)) {}
+  auto& builder = generator->get_builder();
+
+  if (l->getType()->isFPOrFPVectorTy()) {
+    if (op == TOKEN_ADD) {
+      return builder.CreateFAdd(l, r, "addtmp");
+    } else if (op == TOKEN_SUB) {
+      return builder.CreateFSub(l, r, "subtmp");
+    } else if (op == TOKEN_MUL) {
+      return builder.CreateFMul(l, r, "multmp");
+    } else if (op == TOKEN_DIV) {
+      return builder.CreateFDiv(l, r, "divtmp");
+    } else if (op == TOKEN_EQ) {
+      return builder.CreateFCmpOEQ(l, r, "eqtmp");
+    } else if (op == TOKEN_NEQ) {
+      return builder.CreateFCmpUNE(l, r, "netmp");
+    } else if (op == TOKEN_LT) {
+      return builder.CreateFCmpOLT(l, r, "lttmp");
+    } else if (op == TOKEN_GT) {
+      return builder.CreateFCmpOGT(l, r, "gttmp");
+    } else if (op == TOKEN_LEQ) {
+      return builder.CreateFCmpOLE(l, r, "letmp");
+    } else if (op == TOKEN_GEQ) {
+      return builder.CreateFCmpOGE(l, r, "getmp");
+    }
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+    throw codegen_error("unknown floating point operator: " + op);
+  }
 
-class list_codegen : public node_codegen {
- private:
-  std::vector<std::shared_ptr<node_codegen>> children;
+  if (is_unsigned) {
+    if (op == TOKEN_DIV) {
+      return builder.CreateUDiv(l, r, "divtmp");
+    } else if (op == TOKEN_LT) {
+      return builder.CreateICmpULT(l, r, "lttmp");
+    } else if (op == TOKEN_GT) {
+      return builder.CreateICmpUGT(l, r, "gttmp");
+    } else if (op == TOKEN_LEQ) {
+      return builder.CreateICmpULE(l, r, "letmp");
+    } else if (op == TOKEN_GEQ) {
+      return builder.CreateICmpUGE(l, r, "getmp");
+    }
+  }
 
- public:
-  list_codegen(std::vector<std::shared_ptr<node_codegen>> children_nodes)
-      : children(std::move(children_nodes)) {}
+  if (op == TOKEN_ADD) {
+    return builder.CreateAdd(l, r, "addtmp");
+  } else if (op == TOKEN_SUB) {
+    return builder.CreateSub(l, r, "subtmp");
+  } else if (op == TOKEN_MUL) {
+    return builder.CreateMul(l, r, "multmp");
+  } else if (op == TOKEN_DIV) {
+    return builder.CreateSDiv(l, r, "divtmp");
+  } else if (op == TOKEN_EQ) {
+    return builder.CreateICmpEQ(l, r, "eqtmp");
+  } else if (op == TOKEN_NEQ) {
+    return builder.CreateICmpNE(l, r, "netmp");
+  } else if (op == TOKEN_LT) {
+    return builder.CreateICmpSLT(l, r, "lttmp");
+  } else if (op == TOKEN_GT) {
+    return builder.CreateICmpSGT(l, r, "gttmp");
+  } else if (op == TOKEN_LEQ) {
+    return builder.CreateICmpSLE(l, r, "letmp");
+  } else if (op == TOKEN_GEQ) {
+    return builder.CreateICmpSGE(l, r, "getmp");
+  }
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  throw codegen_error("unknown binary operator: " + op);
+}
 
-class let_codegen : public node_codegen {
- private:
-  std::string name;
-  std::string type_name;
-  std::shared_ptr<node_codegen> value;
+void llvm_codegen::initialize_intrinsics() {
+  llvm::Type* void_type = llvm::Type::getVoidTy(*context);
+  llvm::Type* int32_type = llvm::Type::getInt32Ty(*context);
+  llvm::Type* int8_ptr_type = llvm::Type::getInt8PtrTy(*context);
 
- public:
-  let_codegen(std::string var_name, std::string type_name,
-              std::shared_ptr<node_codegen> value_node)
-      : name(std::move(var_name)),
-        type_name(std::move(type_name)),
-        value(std::move(value_node)) {}
+  llvm::FunctionType* printf_type =
+      llvm::FunctionType::get(int32_type, {int8_ptr_type}, true);
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  llvm::Function* printf_func = llvm::Function::Create(
+      printf_type, llvm::Function::ExternalLinkage, "printf", *module);
 
-class set_codegen : public node_codegen {
- private:
-  std::string name;
-  std::shared_ptr<node_codegen> value;
+  intrinsic_functions["printf"] = printf_func;
 
- public:
-  set_codegen(std::string var_name, std::shared_ptr<node_codegen> value_node)
-      : name(std::move(var_name)), value(std::move(value_node)) {}
+  llvm::FunctionType* malloc_type = llvm::FunctionType::get(
+      int8_ptr_type, {llvm::Type::getInt64Ty(*context)}, false);
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  llvm::Function* malloc_func = llvm::Function::Create(
+      malloc_type, llvm::Function::ExternalLinkage, "malloc", *module);
 
-class if_codegen : public node_codegen {
- private:
-  std::shared_ptr<node_codegen> condition;
-  std::shared_ptr<node_codegen> then_branch;
-  std::shared_ptr<node_codegen> else_branch;
+  intrinsic_functions["malloc"] = malloc_func;
 
- public:
-  if_codegen(std::shared_ptr<node_codegen> cond,
-             std::shared_ptr<node_codegen> then_node,
-             std::shared_ptr<node_codegen> else_node)
-      : condition(std::move(cond)),
-        then_branch(std::move(then_node)),
-        else_branch(std::move(else_node)) {}
-
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  llvm::FunctionType* free_type =
+      llvm::FunctionType::get(void_type, {int8_ptr_type}, false);
 
-struct param_info {
-  std::string name;
-  std::string type_name;
-};
+  llvm::Function* free_func = llvm::Function::Create(
+      free_type, llvm::Function::ExternalLinkage, "free", *module);
 
-class def_codegen : public node_codegen {
- private:
-  std::string name;
-  std::string return_type_name;
-  std::vector<param_info> params;
-  std::shared_ptr<node_codegen> body;
+  intrinsic_functions["free"] = free_func;
 
- public:
-  def_codegen(std::string func_name, std::string ret_type,
-              std::vector<param_info> parameters,
-              std::shared_ptr<node_codegen> body_node)
-      : name(std::move(func_name)),
-        return_type_name(std::move(ret_type)),
-        params(std::move(parameters)),
-        body(std::move(body_node)) {}
-
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  // the work-stealing runtime in runtime/parallel.cc
+  llvm::FunctionType* body_type = llvm::FunctionType::get(
+      void_type, {int8_ptr_type, int32_type, int32_type}, false);
+  llvm::FunctionType* parallel_for_type = llvm::FunctionType::get(
+      void_type,
+      {int32_type, int32_type, int32_type, body_type->getPointerTo(),
+       int8_ptr_type},
+      false);
 
-class call_codegen : public node_codegen {
- private:
-  std::string name;
-  std::vector<std::shared_ptr<node_codegen>> args;
+  llvm::Function* parallel_for_func =
+      llvm::Function::Create(parallel_for_type, llvm::Function::ExternalLinkage,
+                             "tl_parallel_for", *module);
 
- public:
-  call_codegen(std::string func_name,
-               std::vector<std::shared_ptr<node_codegen>> arguments)
-      : name(std::move(func_name)), args(std::move(arguments)) {}
+  intrinsic_functions["tl_parallel_for"] = parallel_for_func;
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  // the event loop in runtime/event_loop.cc
+  llvm::FunctionType* handle_type =
+      llvm::FunctionType::get(void_type, {int8_ptr_type}, false);
 
-class binary_op_codegen : public node_codegen {
- private:
-  std::string op;
-  std::shared_ptr<node_codegen> lhs;
-  std::shared_ptr<node_codegen> rhs;
+  intrinsic_functions["tl_loop_ready"] = llvm::Function::Create(
+      handle_type, llvm::Function::ExternalLinkage, "tl_loop_ready", *module);
+  intrinsic_functions["tl_loop_run"] = llvm::Function::Create(
+      handle_type, llvm::Function::ExternalLinkage, "tl_loop_run", *module);
+  intrinsic_functions["tl_loop_sleep"] = llvm::Function::Create(
+      llvm::FunctionType::get(void_type, {int8_ptr_type, int32_type}, false),
+      llvm::Function::ExternalLinkage, "tl_loop_sleep", *module);
+}
 
- public:
-  binary_op_codegen(std::string operation, std::shared_ptr<node_codegen> left,
-                    std::shared_ptr<node_codegen> right)
-      : op(std::move(operation)), lhs(std::move(left)), rhs(std::move(right)) {}
+llvm::Function* llvm_codegen::get_intrinsic(const std::string& name) {
+  auto it = intrinsic_functions.find(name);
+  if (it != intrinsic_functions.end()) {
+    return it->second;
+  }
 
-  llvm::Value* codegen(llvm_codegen& generator) override;
-};
+  return nullptr;
+}
 
-class llvm_codegen : public std::enable_shared_from_this<llvm_codegen> {
- private:
-  std::unique_ptr<llvm::LLVMContext> context;
-  std::unique_ptr<llvm::Module> module;
-  std::unique_ptr<llvm::IRBuilder<>> builder;
+// returns a pointer to a private unnamed_addr global holding `data`, to its
+// first element for arrays, so identical data across the module shares one
+// global and may be merged further by the linker. strings are byte aligned,
+// everything else keeps its abi alignment so loads from it stay aligned
 
-  std::shared_ptr<codegen_scope> global_scope;
-  std::shared_ptr<codegen_scope> current_scope;
+llvm::Constant* llvm_codegen::get_pooled_constant(llvm::Constant* data,
+                                                  const std::string& name) {
+  auto& entry = constant_pool[data];
 
-  llvm_type_mapping type_mapper;
+  if (!entry) {
+    auto* global = new llvm::GlobalVariable(
+        *module, data->getType(), true, llvm::GlobalValue::PrivateLinkage,
+        data, name);
 
-  std::unordered_map<std::string, llvm::Function*> intrinsic_functions;
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    llvm::Type* type = data->getType();
+    bool bytes = type->isArrayTy() &&
+                 type->getArrayElementType()->isIntegerTy(8);
 
- public:
-  llvm_codegen(const std::string& module_name)
-      : context(std::make_unique<llvm::LLVMContext>()),
-        module(std::make_unique<llvm::Module>(module_name, *context)),
-        builder(std::make_unique<llvm::IRBuilder<>>(*context)) {
-    global_scope = std::make_shared<codegen_scope>();
-    current_scope = global_scope;
+    global->setAlignment(bytes ? llvm::Align(1)
+                               : module->getDataLayout().getABITypeAlign(type));
 
-    initialize_intrinsics();
+    llvm::Constant* zero = llvm::ConstantInt::get(builder->getInt32Ty(), 0);
+    llvm::Constant* indices[] = {zero, zero};
+
+    entry = data->getType()->isArrayTy()
+                ? llvm::ConstantExpr::getInBoundsGetElementPtr(
+                      data->getType(), global, indices)
+                : global;
   }
 
-  llvm::LLVMContext& get_context() { return *context; }
-  llvm::Module& get_module() { return *module; }
-  llvm::IRBuilder<>& get_builder() { return *builder; }
+  return entry;
+}
 
-  void set_current_scope(std::shared_ptr<codegen_scope> scope) {
-    current_scope = scope;
-  }
+llvm::Constant* llvm_codegen::get_string_constant(const std::string& value) {
+  return get_pooled_constant(llvm::ConstantDataArray::getString(*context, value),
+                             ".str");
+}
 
-  std::shared_ptr<codegen_scope> get_current_scope() { return current_scope; }
+// uncurries the inferred type of a def with `arity` parameters
+function_type_info llvm_codegen::get_function_type_info(const type_ptr& fn_type,
+                                                        size_t arity) {
+  function_type_info result;
+  type_ptr t = fn_type;
 
-  std::shared_ptr<codegen_scope> create_new_scope() {
-    auto new_scope = current_scope->create_child();
-    return new_scope;
-  }
+  for (size_t i = 0; i < arity; ++i) {
+    auto fn = std::dynamic_pointer_cast<func_type>(t);
 
-  llvm::Type* get_llvm_type(const std::string& type_name) {
-    return type_mapper.get_type(*context, type_name);
-  }
+    if (!fn) {
+      throw codegen_error("expected a function type, found " + t->to_string());
+    }
 
-  llvm::AllocaInst* create_entry_block_alloca(llvm::Function* function,
-                                              const std::string& var_name,
-                                              llvm::Type* type) {
-    llvm::IRBuilder<> temp_builder(&function->getEntryBlock(),
-                                   function->getEntryBlock().begin());
-    return temp_builder.CreateAlloca(type, nullptr, var_name);
+    result.param_types.push_back(get_llvm_type(fn->arg_type));
+    t = fn->ret_type;
   }
 
-  void initialize_intrinsics();
-  llvm::Function* get_intrinsic(const std::string& name);
+  result.return_type = get_llvm_type(t);
+
+  return result;
+}
+
+// both writers stream straight into a buffered file descriptor instead of
+// rendering the whole module into memory first
 
-  function_type_info get_function_type_info(
-      const std::string& return_type,
-      const std::vector<std::string>& param_types);
+std::unique_ptr<llvm::raw_fd_ostream> open_output(
+    const std::string& filename, llvm::sys::fs::OpenFlags flags) {
+  std::error_code ec;
+  auto stream = std::make_unique<llvm::raw_fd_ostream>(filename, ec, flags);
 
-  static llvm::AllocaInst* create_entry_block_alloca_for_func(
-      llvm::Function* function, const std::string& var_name, llvm::Type* type) {
-    llvm::IRBuilder<> temp_builder(&function->getEntryBlock(),
-                                   function->getEntryBlock().begin());
-    return temp_builder.CreateAlloca(type, nullptr, var_name);
+  if (ec) {
+    throw codegen_error("could not open file: " + filename + ": " +
+                        ec.message());
   }
 
-  static llvm::AllocaInst* create_block_alloca(llvm::Function* function,
-                                               llvm::BasicBlock* block,
-                                               const std::string& var_name,
-                                               llvm::Type* type) {
-    llvm::IRBuilder<> temp_builder(block, block->begin());
-    return temp_builder.CreateAlloca(type, nullptr, var_name);
-  }
+  return stream;
+}
 
-  void emit_to_file(const std::string& filename);
-  void emit_bitcode(const std::string& filename);
-  void dump_ir();
-};
+void llvm_codegen::emit_to_file(const std::string& filename) {
+  auto stream = open_output(filename, llvm::sys::fs::OF_Text);
+  module->print(*stream, nullptr);
+}
 
-class codegen_visitor {
- private:
-  std::shared_ptr<llvm_codegen> generator;
+void llvm_codegen::emit_bitcode(const std::string& filename) {
+  auto stream = open_output(filename, llvm::sys::fs::OF_None);
+  llvm::WriteBitcodeToFile(*module, *stream);
+}
 
- public:
-  explicit codegen_visitor(std::shared_ptr<llvm_codegen> gen)
-      : generator(std::move(gen)) {}
+// builds a target machine for the host triple, by default with the host cpu
+// and all of its features, and stamps its data layout onto the module so the
+// optimizer sees the real type sizes
 
-  std::shared_ptr<node_codegen> codegen_node(
-      const std::shared_ptr<typed_lisp::node>& node);
-};
+void llvm_codegen::initialize_target(const std::string& cpu,
+                                     llvm::OptimizationLevel level) {
+  initialize_native_target();
 
-llvm::Value* atom_codegen::codegen(llvm_codegen& generator) {
-  if (value == TOKEN_PROGRAM) {
-    return llvm::ConstantInt::get(generator.get_context(),
-                                  llvm::APInt(1, 1, false));
-  } else if (value == TOKEN_FALSE) {
-    return llvm::ConstantInt::get(generator.get_context(),
-                                  llvm::APInt(1, 0, false));
-  }
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string error;
+  const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
 
-  try {
-    int int_val = std::stoi(value);
-    return llvm::ConstantInt::get(generator.get_context(),
-                                  llvm::APInt(32, int_val, true));
-  } catch (...) {
+  if (!target) {
+    throw codegen_error("could not find target " + triple + ": " + error);
   }
 
-  if (value.front() == TOKEN_QUOTE && value.back() == TOKEN_QUOTE) {
-    std::string str_val = value.substr(1, value.size() - 2);
+  std::string cpu_name = cpu;
+  std::string features;
 
-    llvm::IRBuilder<>& builder = generator.get_builder();
-    llvm::Value* str_constant = builder.CreateGlobalStringPtr(str_val);
+  if (cpu_name.empty()) {
+    cpu_name = llvm::sys::getHostCPUName().str();
 
-    return str_constant;
+    llvm::StringMap<bool> host_features;
+    if (llvm::sys::getHostCPUFeatures(host_features)) {
+      for (const auto& feature : host_features) {
+        features += (features.empty() ? "" : ",");
+        features += (feature.getValue() ? "+" : "-") + feature.getKey().str();
+      }
+    }
   }
 
-  llvm::AllocaInst* var = generator.get_current_scope()->get_value(value);
-  if (!var) {
-    throw codegen_error("undefined variable: " + value);
+  llvm::CodeGenOpt::Level codegen_level = llvm::CodeGenOpt::Default;
+
+  switch (level.getSpeedupLevel()) {
+    case 0:
+      codegen_level = llvm::CodeGenOpt::None;
+      break;
+    case 1:
+      codegen_level = llvm::CodeGenOpt::Less;
+      break;
+    case 3:
+      codegen_level = llvm::CodeGenOpt::Aggressive;
+      break;
   }
 
-  return generator.get_builder().CreateLoad(var->getAllocatedType(), var,
-                                            value);
+  target_machine.reset(target->createTargetMachine(
+      triple, cpu_name, features, llvm::TargetOptions(), llvm::Reloc::PIC_, {},
+      codegen_level));
+
+  module->setTargetTriple(triple);
+  module->setDataLayout(target_machine->createDataLayout());
 }
 
-llvm::Value* list_codegen::codegen(llvm_codegen& generator) {
-  if (children.empty()) {
-    return llvm::ConstantTokenNone::get(generator.get_context());
+void llvm_codegen::emit_native(const std::string& filename,
+                               llvm::CodeGenFileType type) {
+  if (!target_machine) {
+    throw codegen_error("no target machine to emit native code");
   }
 
-  llvm::Value* result = nullptr;
-  for (const auto& child : children) {
-    result = child->codegen(generator);
+  auto dest = open_output(filename, llvm::sys::fs::OF_None);
+  llvm::legacy::PassManager pass_manager;
+
+  if (target_machine->addPassesToEmitFile(pass_manager, *dest, nullptr,
+                                          type)) {
+    throw codegen_error("target cannot emit a file of this type");
   }
 
-  return result;
+  pass_manager.run(*module);
 }
 
-llvm::Value* let_codegen::codegen(llvm_codegen& generator) {
-  llvm::Value* val = value->codegen(generator);
-
-  if (!val) {
-    throw codegen_error("invalid value in let expression");
+void llvm_codegen::link_in(std::unique_ptr<llvm::Module> other) {
+  if (llvm::Linker::linkModules(*module, std::move(other))) {
+    throw codegen_error("could not link module partitions");
   }
+}
 
-  llvm::Type* var_type = generator.get_llvm_type(type_name);
+void llvm_codegen::verify() {
+  std::string message;
+  llvm::raw_string_ostream stream(message);
 
-  llvm::Function* func = generator.get_builder().GetInsertBlock()->getParent();
-  llvm::AllocaInst* alloca =
-      generator.create_entry_block_alloca(func, name, var_type);
+  if (llvm::verifyModule(*module, &stream)) {
+    throw codegen_error("invalid module: " + stream.str());
+  }
+}
 
-  generator.get_builder().CreateStore(val, alloca);
+// runs the new pass manager's default pipeline for the level, when timing is
+// given the wall time of every pass is reported to it
+
+void optimize_module(llvm::Module& module, llvm::OptimizationLevel level,
+                     llvm::TargetMachine* target_machine,
+                     std::ostream* timing) {
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  llvm::PassInstrumentationCallbacks pic;
+  llvm::TimePassesHandler timer(timing != nullptr);
+  timer.registerCallbacks(pic);
+
+  llvm::PassBuilder pass_builder(target_machine, llvm::PipelineTuningOptions(),
+                                 {}, &pic);
+
+  pass_builder.registerModuleAnalyses(mam);
+  pass_builder.registerCGSCCAnalyses(cgam);
+  pass_builder.registerFunctionAnalyses(fam);
+  pass_builder.registerLoopAnalyses(lam);
+  pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+  llvm::ModulePassManager pass_manager =
+      level == llvm::OptimizationLevel::O0
+          ? pass_builder.buildO0DefaultPipeline(level)
+          : pass_builder.buildPerModuleDefaultPipeline(level);
+
+  pass_manager.run(module, mam);
+
+  if (timing) {
+    llvm::raw_os_ostream stream(*timing);
+    timer.setOutStream(stream);
+    timer.print();
+  }
+}
 
-  generator.get_current_scope()->set_value(name, alloca);
+void llvm_codegen::optimize(llvm::OptimizationLevel level,
+                            std::ostream* timing) {
+  optimize_module(*module, level, target_machine.get(), timing);
+}
 
-  return val;
+// target registration is process-wide in LLVM, every compilation shares it
+void initialize_native_target() {
+  static std::once_flag once;
+
+  std::call_once(once, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+  });
 }
 
-llvm::Value* set_codegen::codegen(llvm_codegen& generator) {
-  llvm::Value* val = value->codegen(generator);
+// executes `main` in-process with a lazy JIT, functions are split into their
+// own partitions and only optimized and compiled when first called. pass
+// timings are reported per partition, which may be compiled on any thread
+// that calls into it
 
-  if (!val) {
-    throw codegen_error("invalid value in set expression");
-  }
+int run_jit(std::unique_ptr<llvm::Module> module,
+            std::unique_ptr<llvm::LLVMContext> context,
+            llvm::OptimizationLevel level, std::ostream* timing) {
+  initialize_native_target();
 
-  llvm::AllocaInst* var = generator.get_current_scope()->get_value(name);
+  std::mutex timing_mutex;
 
-  if (!var) {
-    throw codegen_error("undefined variable: " + name);
+  auto jit = llvm::orc::LLLazyJITBuilder().create();
+
+  if (!jit) {
+    throw codegen_error("could not create JIT: " +
+                        llvm::toString(jit.takeError()));
   }
 
-  generator.get_builder().CreateStore(val, var);
+  // printf, malloc and free resolve against the host process
+  auto& main_dylib = (*jit)->getMainJITDylib();
+  main_dylib.addGenerator(llvm::cantFail(
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*jit)->getDataLayout().getGlobalPrefix())));
+
+  // the parallel and event loop runtimes are linked into tlc itself
+  llvm::orc::SymbolMap runtime_symbols;
+
+  auto define_runtime_symbol = [&](const char* name, auto* address) {
+#if LLVM_VERSION_MAJOR >= 17
+    runtime_symbols[(*jit)->mangleAndIntern(name)] =
+        llvm::orc::ExecutorSymbolDef(llvm::orc::ExecutorAddr::fromPtr(address),
+                                     llvm::JITSymbolFlags::Exported);
+#else
+    runtime_symbols[(*jit)->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(address),
+        llvm::JITSymbolFlags::Exported);
+#endif
+  };
 
-  return val;
-}
+  define_runtime_symbol("tl_parallel_for", &tl_parallel_for);
+  define_runtime_symbol("tl_loop_ready", &tl_loop_ready);
+  define_runtime_symbol("tl_loop_sleep", &tl_loop_sleep);
+  define_runtime_symbol("tl_loop_run", &tl_loop_run);
 
-llvm::Value* if_codegen::codegen(llvm_codegen& generator) {
-  llvm::Value* cond_val = condition->codegen(generator);
+  llvm::cantFail(main_dylib.define(llvm::orc::absoluteSymbols(runtime_symbols)));
 
-  if (!cond_val) {
-    throw codegen_error("invalid condition in if expression");
+  (*jit)->getIRTransformLayer().setTransform(
+      [level, timing, &timing_mutex](llvm::orc::ThreadSafeModule partition,
+                                     llvm::orc::MaterializationResponsibility&)
+          -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+        std::ostringstream report;
+
+        partition.withModuleDo([&](llvm::Module& m) {
+          optimize_module(m, level, nullptr, timing ? &report : nullptr);
+        });
+
+        if (timing) {
+          std::lock_guard<std::mutex> lock(timing_mutex);
+          *timing << report.str();
+        }
+
+        return partition;
+      });
+
+  if (auto err = (*jit)->addLazyIRModule(llvm::orc::ThreadSafeModule(
+          std::move(module), llvm::orc::ThreadSafeContext(std::move(context))))) {
+    throw codegen_error("could not add module to JIT: " +
+                        llvm::toString(std::move(err)));
   }
 
-  cond_val = generator.get_builder().CreateICmpNE(
-      cond_val,
-      llvm::ConstantInt::get(generator.get_context(), llvm::APInt(1, 0, false)),
-      "ifcond");
+  auto main_symbol = (*jit)->lookup("main");
 
-  llvm::Function* func = generator.get_builder().GetInsertBlock()->getParent();
+  if (!main_symbol) {
+    throw codegen_error("could not find main: " +
+                        llvm::toString(main_symbol.takeError()));
+  }
 
-  llvm::BasicBlock* then_bb =
-      llvm::BasicBlock::Create(generator.get_context(), "then", func);
-  llvm::BasicBlock* else_bb =
-      llvm::BasicBlock::Create(generator.get_context(), "else", func);
-  llvm::BasicBlock* merge_bb =
-      llvm::BasicBlock::Create(generator.get_context(), "ifcont", func);
+#if LLVM_VERSION_MAJOR >= 15
+  auto* main_fn = main_symbol->toPtr<int (*)()>();
+#else
+  auto* main_fn = reinterpret_cast<int (*)()>(main_symbol->getAddress());
+#endif
 
-  generator.get_builder().CreateCondBr(cond_val, then_bb, else_bb);
+  return main_fn();
+}
 
-  // for the builder we cannot access with getBasicBlockList, first create with
-  // BasicBlock::Create then insert into fns with Function::getEntryBlock()
+void llvm_codegen::dump_ir(std::ostream& os) {
+  llvm::raw_os_ostream stream(os);
+  module->print(stream, nullptr);
+}
 
-  generator.get_builder().SetInsertPoint(then_bb);
+llvm::Value* codegen_visitor::codegen_node(
+    const std::shared_ptr<typed_lisp::node>& node, bool tail) {
+  if (auto atom_node = std::dynamic_pointer_cast<typed_lisp::atom>(node)) {
+    return codegen_atom(atom_node);
+  }
 
-  llvm::Value* then_val = then_branch->codegen(generator);
-  if (!then_val) {
-    throw codegen_error("invalid then branch in if expression");
+  auto list_node = std::dynamic_pointer_cast<typed_lisp::list>(node);
+
+  if (!list_node || list_node->children.empty()) {
+    throw codegen_error("cannot lower empty list");
   }
 
-  generator.get_builder().CreateBr(merge_bb);
-  then_bb = generator.get_builder().GetInsertBlock();
+  auto first =
+      std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[0]);
 
-  generator.get_builder().SetInsertPoint(else_bb);
+  if (!first) {
+    throw codegen_error("first element of list must be an atom");
+  }
 
-  llvm::Value* else_val = else_branch->codegen(generator);
-  if (!else_val) {
-    throw codegen_error("invalid else branch in if expression");
+  if (first->value == TOKEN_PROGRAM) {
+    return codegen_sequence(list_node, 1, tail);
+  } else if (first->value == TOKEN_LET) {
+    return codegen_let(list_node);
+  } else if (first->value == TOKEN_SET) {
+    return codegen_set(list_node);
+  } else if (first->value == TOKEN_IF) {
+    return codegen_if(list_node, tail);
+  } else if (first->value == TOKEN_WHILE) {
+    return codegen_while(list_node);
+  } else if (first->value == TOKEN_FOR ||
+             first->value == TOKEN_PARALLEL_FOR) {
+    return codegen_for(list_node);
+  } else if (first->value == TOKEN_PARALLEL_MAP) {
+    return codegen_parallel_map(list_node);
+  } else if (first->value == TOKEN_AWAIT || first->value == TOKEN_SLEEP) {
+    return codegen_await(list_node);
+  } else if (first->value == TOKEN_CAST) {
+    return codegen_cast(list_node);
+  } else if (is_vector_op(first->value)) {
+    return codegen_vector_op(list_node);
+  } else if (first->value == TOKEN_STRUCT || first->value == TOKEN_NEW ||
+             first->value == TOKEN_FIELD || first->value == TOKEN_WITH) {
+    return codegen_record(list_node);
+  } else if (first->value == TOKEN_DEF) {
+    return codegen_def(list_node);
   }
 
-  generator.get_builder().CreateBr(merge_bb);
-  else_bb = generator.get_builder().GetInsertBlock();
+  return codegen_call(list_node, tail);
+}
 
-  generator.get_builder().SetInsertPoint(merge_bb);
+bool is_def(const std::shared_ptr<typed_lisp::node>& node) {
+  auto list_node = std::dynamic_pointer_cast<typed_lisp::list>(node);
 
-  llvm::PHINode* pn =
-      generator.get_builder().CreatePHI(then_val->getType(), 2, "iftmp");
+  if (!list_node || list_node->children.empty()) return false;
 
-  pn->addIncoming(then_val, then_bb);
-  pn->addIncoming(else_val, else_bb);
+  auto first =
+      std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[0]);
 
-  return pn;
+  return first && first->value == TOKEN_DEF;
 }
 
-llvm::Value* def_codegen::codegen(llvm_codegen& generator) {
-  std::vector<std::string> param_type_names;
-  std::vector<std::string> param_names;
+std::vector<std::shared_ptr<list>> top_level_defs(
+    const std::shared_ptr<typed_lisp::node>& ast) {
+  std::vector<std::shared_ptr<list>> defs;
 
-  for (const auto& param : params) {
-    param_type_names.push_back(param.type_name);
-    param_names.push_back(param.name);
+  if (is_def(ast)) {
+    defs.push_back(std::static_pointer_cast<list>(ast));
+    return defs;
   }
 
-  auto type_info =
-      generator.get_function_type_info(return_type_name, param_type_names);
+  auto program = std::dynamic_pointer_cast<typed_lisp::list>(ast);
 
-  llvm::FunctionType* func_type = type_info.create_function_type();
+  if (!program || program->children.empty()) return defs;
 
-  llvm::Function* func = llvm::Function::Create(
-      func_type, llvm::Function::ExternalLinkage, name, generator.get_module());
+  auto first = std::dynamic_pointer_cast<typed_lisp::atom>(program->children[0]);
 
-  generator.get_current_scope()->set_function(name, func);
+  if (!first || first->value != TOKEN_PROGRAM) return defs;
 
-  unsigned idx = 0;
-  for (auto& arg : func->args()) {
-    arg.setName(param_names[idx++]);
+  for (size_t i = 1; i < program->children.size(); ++i) {
+    if (is_def(program->children[i])) {
+      defs.push_back(std::static_pointer_cast<list>(program->children[i]));
+    }
   }
 
-  llvm::BasicBlock* entry_bb =
-      llvm::BasicBlock::Create(generator.get_context(), "entry", func);
-  generator.get_builder().SetInsertPoint(entry_bb);
+  return defs;
+}
 
-  auto function_scope = generator.create_new_scope();
-  generator.set_current_scope(function_scope);
+void codegen_visitor::declare_top_level_defs(
+    const std::shared_ptr<typed_lisp::node>& ast) {
+  partitioned = true;
+  collect_def_names(ast);
 
-  idx = 0;
-  for (auto& arg : func->args()) {
-    llvm::AllocaInst* alloca = generator.create_entry_block_alloca(
-        func, arg.getName().str(), arg.getType());
+  for (const auto& def : top_level_defs(ast)) {
+    declare_def(def);
+  }
+}
 
-    generator.get_builder().CreateStore(&arg, alloca);
+// walks the top-level forms in order so that a def sees the globals of the
+// lets before it, the external defs only get their prototype
+void codegen_visitor::codegen_defs(
+    const std::shared_ptr<typed_lisp::node>& ast) {
+  auto program = std::dynamic_pointer_cast<typed_lisp::list>(ast);
 
-    function_scope->set_value(arg.getName().str(), alloca);
-    idx++;
+  if (is_def(ast) || !program) {
+    for (const auto& def : top_level_defs(ast)) codegen_def(def);
+    return;
   }
 
-  llvm::Value* body_val = body->codegen(generator);
+  for (size_t i = 1; i < program->children.size(); ++i) {
+    auto form = std::dynamic_pointer_cast<list>(program->children[i]);
+    auto head = form && !form->children.empty()
+                    ? std::dynamic_pointer_cast<atom>(form->children[0])
+                    : nullptr;
 
-  if (body_val) {
-    generator.get_builder().CreateRet(body_val);
+    if (is_def(form)) {
+      codegen_def(form);
+    } else if (head && head->value == TOKEN_LET && form->children.size() == 5) {
+      auto name_node = std::dynamic_pointer_cast<atom>(form->children[1]);
 
-    llvm::verifyFunction(*func);
-  } else {
-    func->eraseFromParent();
-    throw codegen_error("invalid function body");
+      if (name_node && def_reads.count(name_node->value)) {
+        declare_global(form);
+      }
+    }
   }
+}
 
-  generator.set_current_scope(generator.get_current_scope()->create_child());
+llvm::Function* codegen_visitor::codegen_program(
+    const std::shared_ptr<typed_lisp::node>& ast) {
+  auto& builder = generator->get_builder();
+  llvm::Type* int32_type = llvm::Type::getInt32Ty(generator->get_context());
 
-  return func;
-}
+  llvm::Function* main_func = llvm::Function::Create(
+      llvm::FunctionType::get(int32_type, false),
+      llvm::Function::ExternalLinkage, "main", generator->get_module());
 
-llvm::Value* call_codegen::codegen(llvm_codegen& generator) {
-  llvm::Function* callee = generator.get_current_scope()->get_function(name);
+  builder.SetInsertPoint(
+      llvm::BasicBlock::Create(generator->get_context(), "entry", main_func));
 
-  if (!callee) {
-    throw codegen_error("unknown function: " + name);
-  }
+  assigned_names.clear();
+  collect_assigned_names(ast, assigned_names);
+  collect_def_names(ast);
 
-  if (callee->arg_size() != args.size()) {
-    throw codegen_error("incorrect number of arguments passed to function: " +
-                        name);
+  // top-level defs can call the ones after them
+  for (const auto& def : top_level_defs(ast)) {
+    declare_def(def);
   }
 
-  std::vector<llvm::Value*> arg_values;
-  for (const auto& arg : args) {
-    arg_values.push_back(arg->codegen(generator));
+  llvm::Value* result = codegen_node(ast);
+
+  // the value of the last top-level form is the exit status when it is an
+  // integer or boolean, anything else exits with 0
+  if (result && result->getType()->isIntegerTy(32)) {
+    builder.CreateRet(result);
+  } else if (result && result->getType()->isIntegerTy(1)) {
+    builder.CreateRet(builder.CreateZExt(result, int32_type));
+  } else {
+    builder.CreateRet(llvm::ConstantInt::get(int32_type, 0));
   }
 
-  return generator.get_builder().CreateCall(callee, arg_values, "calltmp");
+  return main_func;
 }
 
-llvm::Value* binary_op_codegen::codegen(llvm_codegen& generator) {
-  llvm::Value* l = lhs->codegen(generator);
-  llvm::Value* r = rhs->codegen(generator);
+enum class emit_kind { llvm, bitcode, assembly, object };
+
+struct compile_options {
+  bool print_stats = false;
+  bool dump_ir = false;
+  bool time_passes = false;
+  bool run = false;
+  bool fast_math = false;
+  emit_kind emit = emit_kind::llvm;
+  std::string target_cpu;
+  unsigned jobs = 1;
+  llvm::OptimizationLevel opt_level = llvm::OptimizationLevel::O0;
+  std::string stats_path;
+  std::string output_path;
+};
 
-  if (!l || !r) {
-    throw codegen_error("invalid operands for binary operator");
-  }
+// the module is named after the input file without directories or extension
+std::string module_name_for(const std::string& input_path) {
+  std::string name = input_path.substr(input_path.find_last_of('/') + 1);
+  return name.substr(0, name.find_last_of('.'));
+}
 
-  if (op == TOKEN_ADD) {
-    return generator.get_builder().CreateAdd(l, r, "addtmp");
-  } else if (op == TOKEN_SUB) {
-    return generator.get_builder().CreateSub(l, r, "subtmp");
-  } else if (op == TOKEN_MUL) {
-    return generator.get_builder().CreateMul(l, r, "multmp");
-  } else if (op == TOKEN_DIV) {
-    return generator.get_builder().CreateSDiv(l, r, "divtmp");
-  } else if (op == TOKEN_EQ) {
-    return generator.get_builder().CreateICmpEQ(l, r, "eqtmp");
-  } else if (op == TOKEN_NEQ) {
-    return generator.get_builder().CreateICmpNE(l, r, "netmp");
-  } else if (op == TOKEN_LT) {
-    return generator.get_builder().CreateICmpSLT(l, r, "lttmp");
-  } else if (op == TOKEN_GT) {
-    return generator.get_builder().CreateICmpSGT(l, r, "gttmp");
-  } else if (op == TOKEN_LEQ) {
-    return generator.get_builder().CreateICmpSLE(l, r, "letmp");
-  } else if (op == TOKEN_GEQ) {
-    return generator.get_builder().CreateICmpSGE(l, r, "getmp");
-  } else if (op == "and") {
-    return generator.get_builder().CreateAnd(l, r, "andtmp");
-  } else if (op == "or") {
-    return generator.get_builder().CreateOr(l, r, "ortmp");
+void emit_output(llvm_codegen& generator, const compile_options& options) {
+  switch (options.emit) {
+    case emit_kind::llvm:
+      generator.emit_to_file(options.output_path);
+      break;
+    case emit_kind::bitcode:
+      generator.emit_bitcode(options.output_path);
+      break;
+    case emit_kind::assembly:
+      generator.emit_native(options.output_path, llvm::CGFT_AssemblyFile);
+      break;
+    case emit_kind::object:
+      generator.emit_native(options.output_path, llvm::CGFT_ObjectFile);
+      break;
   }
-
-  throw codegen_error("unknown binary operator: " + op);
 }
 
-void llvm_codegen::initialize_intrinsics() {
-  llvm::Type* void_type = llvm::Type::getVoidTy(*context);
-  llvm::Type* int32_type = llvm::Type::getInt32Ty(*context);
-  llvm::Type* int8_ptr_type = llvm::Type::getInt8PtrTy(*context);
+// splits the top-level defs over `options.jobs` workers, balanced by their
+// size in nodes, and lowers, optimizes and emits every partition on its own
+// thread with its own LLVMContext. objects are combined with a relocatable
+// link, other outputs by linking the optimized modules into the compilation's
+// context. cross-partition calls are not inlined, which is the price of
+// running the optimizer and the code generator in parallel
+
+void emit_partitioned(compiler_context& ctx,
+                      const std::shared_ptr<node>& ast,
+                      const node_type_map& node_types,
+                      const std::string& module_name,
+                      const compile_options& options, std::ostream& out,
+                      std::ostream& err) {
+  auto defs = top_level_defs(ast);
+  size_t jobs = std::max<size_t>(1, std::min<size_t>(options.jobs,
+                                                     defs.size() + 1));
+
+  std::function<size_t(const std::shared_ptr<node>&)> weight =
+      [&](const std::shared_ptr<node>& n) -> size_t {
+    size_t total = 1;
+    if (auto l = std::dynamic_pointer_cast<list>(n)) {
+      for (const auto& child : l->children) total += weight(child);
+    }
+    return total;
+  };
 
-  llvm::FunctionType* printf_type =
-      llvm::FunctionType::get(int32_type, {int8_ptr_type}, true);
+  // partition 0 also lowers main, which is charged with the whole program
+  // minus the defs so that heavy top-level code is not stacked with defs
+  std::vector<std::vector<std::shared_ptr<list>>> owned(jobs);
+  std::vector<size_t> load(jobs, 0);
+  load[0] = weight(ast);
 
-  llvm::Function* printf_func = llvm::Function::Create(
-      printf_type, llvm::Function::ExternalLinkage, "printf", *module);
+  for (const auto& def : defs) load[0] -= std::min(load[0], weight(def));
 
-  intrinsic_functions["printf"] = printf_func;
+  auto by_weight = defs;
+  std::stable_sort(by_weight.begin(), by_weight.end(),
+                   [&](const auto& a, const auto& b) {
+                     return weight(a) > weight(b);
+                   });
 
-  llvm::FunctionType* malloc_type =
-      llvm::FunctionType::get(int8_ptr_type, {int32_type}, false);
+  for (const auto& def : by_weight) {
+    size_t target = std::min_element(load.begin(), load.end()) - load.begin();
+    owned[target].push_back(def);
+    load[target] += weight(def);
+  }
 
-  llvm::Function* malloc_func = llvm::Function::Create(
-      malloc_type, llvm::Function::ExternalLinkage, "malloc", *module);
+  // like the single partition path nothing is written without -o, the
+  // partitions are then linked in memory for --dump-ir
+  bool native_object =
+      options.emit == emit_kind::object && !options.output_path.empty();
 
-  intrinsic_functions["malloc"] = malloc_func;
+  struct partition_output {
+    std::string object_path;
+    llvm::SmallVector<char, 0> bitcode;
+    std::ostringstream timing;
+    std::string error;
+  };
 
-  llvm::FunctionType* free_type =
-      llvm::FunctionType::get(void_type, {int8_ptr_type}, false);
+  std::vector<partition_output> outputs(jobs);
+  std::vector<std::thread> workers;
+
+  for (size_t p = 0; p < jobs; ++p) {
+    workers.emplace_back([&, p] {
+      try {
+        compiler_context worker_ctx;
+        auto generator = std::make_shared<llvm_codegen>(
+            worker_ctx, module_name + "." + std::to_string(p));
+        if (options.fast_math) generator->enable_fast_math();
+        codegen_visitor codegen(generator, node_types);
+
+        std::unordered_set<const list*> external;
+        for (const auto& def : defs) external.insert(def.get());
+        for (const auto& def : owned[p]) external.erase(def.get());
+
+        codegen.declare_top_level_defs(ast);
+        codegen.set_external_defs(std::move(external));
+
+        if (p == 0) {
+          codegen.codegen_program(ast);
+        } else {
+          codegen.codegen_defs(ast);
+        }
 
-  llvm::Function* free_func = llvm::Function::Create(
-      free_type, llvm::Function::ExternalLinkage, "free", *module);
+        generator->verify();
+        generator->initialize_target(options.target_cpu, options.opt_level);
+        generator->optimize(options.opt_level,
+                            options.time_passes ? &outputs[p].timing : nullptr);
+
+        if (native_object) {
+          outputs[p].object_path =
+              options.output_path + ".part" + std::to_string(p) + ".o";
+          generator->emit_native(outputs[p].object_path, llvm::CGFT_ObjectFile);
+        } else {
+          llvm::raw_svector_ostream stream(outputs[p].bitcode);
+          llvm::WriteBitcodeToFile(generator->get_module(), stream);
+        }
+      } catch (const std::exception& e) {
+        outputs[p].error = e.what();
+      }
+    });
+  }
 
-  intrinsic_functions["free"] = free_func;
-}
+  for (auto& worker : workers) {
+    worker.join();
+  }
 
-llvm::Function* llvm_codegen::get_intrinsic(const std::string& name) {
-  auto it = intrinsic_functions.find(name);
-  if (it != intrinsic_functions.end()) {
-    return it->second;
+  for (auto& output : outputs) {
+    err << output.timing.str();
+
+    if (!output.error.empty()) {
+      for (auto& o : outputs) {
+        if (!o.object_path.empty()) llvm::sys::fs::remove(o.object_path);
+      }
+
+      throw codegen_error(output.error);
+    }
   }
 
-  return nullptr;
-}
+  if (native_object) {
+    auto ld = llvm::sys::findProgramByName("ld");
 
-function_type_info llvm_codegen::get_function_type_info(
-    const std::string& return_type,
-    const std::vector<std::string>& param_types) {
-  function_type_info result;
+    if (!ld) {
+      throw codegen_error("could not find ld to combine partition objects");
+    }
+
+    std::vector<llvm::StringRef> args = {*ld, "-r", "-o", options.output_path};
+    for (const auto& output : outputs) args.push_back(output.object_path);
 
-  result.return_type = get_llvm_type(return_type);
+    std::string message;
+    int status = llvm::sys::ExecuteAndWait(*ld, args, llvm::None, {}, 0, 0,
+                                           &message);
 
-  for (const auto& param_type : param_types) {
-    result.param_types.push_back(get_llvm_type(param_type));
+    for (const auto& output : outputs) {
+      llvm::sys::fs::remove(output.object_path);
+    }
+
+    if (status != 0) {
+      throw codegen_error("could not combine partition objects: " + message);
+    }
+
+    return;
   }
 
-  return result;
-}
+  auto merged = std::make_shared<llvm_codegen>(ctx, module_name);
 
-void llvm_codegen::emit_to_file(const std::string& filename) {
-  std::string str;
-  llvm::raw_string_ostream stream(str);
+  for (auto& output : outputs) {
+    auto partition = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(
+            llvm::StringRef(output.bitcode.data(), output.bitcode.size()),
+            module_name),
+        merged->get_context());
+
+    if (!partition) {
+      throw codegen_error("could not read partition: " +
+                          llvm::toString(partition.takeError()));
+    }
 
-  stream << *module;
-  stream.flush();
+    merged->link_in(std::move(*partition));
+  }
 
-  // @fix LLVM_LIBS bitwriter & support not linking issue
-  // write string to file using standard C++ file I/O instead
-  std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+  merged->initialize_target(options.target_cpu, options.opt_level);
 
-  if (!outfile) {
-    throw codegen_error("could not open file: " + filename);
+  if (!options.output_path.empty()) {
+    emit_output(*merged, options);
   }
 
-  outfile.write(str.c_str(), str.size());
-  outfile.close();
+  if (options.dump_ir) {
+    merged->dump_ir(out);
+  }
 }
 
-void llvm_codegen::emit_bitcode(const std::string& filename) {
-  std::string buffer;
-  llvm::raw_string_ostream stream(buffer);
+struct compile_result {
+  int status = 0;
+  std::string output;
+  std::string diagnostics;
+  std::string stats_json;
+};
+
+// one compilation end to end on its own context, output is buffered so that
+// compilations running on other threads do not interleave their diagnostics
 
-  // write bitcode to memory buffer
-  // llvm::WriteBitcodeToFile(*module, stream);
-  stream.flush();
+compile_result compile_file(const std::string& input_path,
+                            const compile_options& options) {
+  compile_result result;
+  std::ostringstream out;
+  std::ostringstream err;
 
-  std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+  std::ifstream file(input_path);
 
-  if (!outfile) {
-    throw codegen_error("could not open file: " + filename);
+  if (!file) {
+    result.status = 1;
+    result.diagnostics = "error: could not open file: " + input_path + "\n";
+    return result;
   }
 
-  outfile.write(buffer.c_str(), buffer.size());
-  outfile.close();
-}
+  std::string test_program((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
 
-void llvm_codegen::dump_ir() { module->print(llvm::outs(), nullptr); }
+  compiler_context ctx;
+  lisp_parser parser(test_program);
 
-std::shared_ptr<node_codegen> codegen_visitor::codegen_node(
-    const std::shared_ptr<typed_lisp::node>& node) {
-  if (auto atom_node = std::dynamic_pointer_cast<typed_lisp::atom>(node)) {
-    return std::make_shared<atom_codegen>(atom_node->value);
-  } else if (auto list_node =
-                 std::dynamic_pointer_cast<typed_lisp::list>(node)) {
-    if (list_node->children.empty()) {
-      return std::make_shared<list_codegen>(
-          std::vector<std::shared_ptr<node_codegen>>{});
-    }
+  try {
+    std::shared_ptr<node> ast = parser.parse();
+    auto visitor = std::make_shared<type_visitor>(parser, ctx);
 
-    auto first =
-        std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[0]);
+    ast->accept(visitor.get());
+    visitor->finalize_types();
 
-    if (!first) {
-      throw codegen_error("first element of list must be an atom");
-    }
+    const auto& errors = visitor->get_errors();
 
-    if (first->value == TOKEN_LET) {
-      if (list_node->children.size() != 5) {
-        throw codegen_error("invalid let expression");
+    if (errors.empty()) {
+      out << "no type errors found!\n";
+    } else {
+      for (const auto& error : errors) {
+        out << error << "\n";
       }
 
-      auto name_node =
-          std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[1]);
-      auto colon =
-          std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[2]);
-      auto type_node =
-          std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[3]);
+      result.status = 1;
+    }
+
+    if (errors.empty()) {
+      ast = constant_folder(visitor->get_node_types()).fold(ast);
+    }
 
-      if (!name_node || !colon || !type_node || colon->value != TOKEN_COLON) {
-        throw codegen_error("invalid let syntax");
+    if (errors.empty() && options.jobs > 1 && !options.run) {
+      emit_partitioned(ctx, ast, visitor->get_node_types(),
+                       module_name_for(input_path), options, out, err);
+    } else if (errors.empty()) {
+      auto generator =
+          std::make_shared<llvm_codegen>(ctx, module_name_for(input_path));
+      if (options.fast_math) generator->enable_fast_math();
+      codegen_visitor codegen(generator, visitor->get_node_types());
+
+      codegen.codegen_program(ast);
+      generator->verify();
+      generator->initialize_target(options.target_cpu, options.opt_level);
+
+      if (options.run) {
+        // compiler output goes out before anything the program prints
+        std::cout << out.str() << std::flush;
+        std::cerr << err.str() << std::flush;
+        out.str("");
+        err.str("");
+
+        result.status = run_jit(generator->take_module(),
+                                std::move(ctx.llvm_context), options.opt_level,
+                                options.time_passes ? &err : nullptr);
+        result.output = out.str();
+        result.diagnostics = err.str();
+
+        return result;
       }
 
-      auto value_codegen = codegen_node(list_node->children[4]);
+      generator->optimize(options.opt_level,
+                          options.time_passes ? &err : nullptr);
 
-      return std::make_shared<let_codegen>(name_node->value, type_node->value,
-                                           value_codegen);
-    } else if (first->value == TOKEN_SET) {
-      if (list_node->children.size() != 3) {
-        throw codegen_error("invalid set expression");
+      if (!options.output_path.empty()) {
+        emit_output(*generator, options);
       }
 
-      auto name_node =
-          std::dynamic_pointer_cast<typed_lisp::atom>(list_node->children[1]);
-
-      if (!name_node) {
-        throw codegen_error("invalid set syntax");
+      if (options.dump_ir) {
+        generator->dump_ir(out);
       }
+    }
 
-      auto value_codegen = codegen_node(list_node->children[2]);
+  } catch (const std::exception& e) {
+    err << "error: " << e.what() << std::endl;
+    result.status = 1;
+  }
 
-      return std::make_shared<set_codegen>(name_node->value, value_codegen);
-    } else if (first->value == TOKEN_IF) {
-      if (list_node->children.size() != 4) {
-        throw codegen_error("invalid if expression");
-      }
+  if (options.print_stats) {
+    ctx.stats.print(err);
+  }
 
-      // auto cond_codegen = codegen_node(list_node);
-    }
+  if (!options.stats_path.empty()) {
+    std::ostringstream stats;
+    ctx.stats.print_json(stats, input_path);
+    result.stats_json = stats.str();
   }
+
+  result.output = out.str();
+  result.diagnostics = err.str();
+
+  return result;
 }
 }  // namespace typed_lisp
 
-int main() {
+#ifndef TYPED_LISP_NO_MAIN
+int main(int argc, char** argv) {
   // typed_lisp::type_system ty;
   // typed_lisp::type_env env;
 
@@ -1697,35 +5975,158 @@ int main() {
   //   std::cout << "type error: " << e.what() << "\n";
   // }
 
-  std::ifstream file("tests/valid-def-expr.lsp");
-  std::string test_program((std::istreambuf_iterator<char>(file)),
-                           std::istreambuf_iterator<char>());
+  std::vector<std::string> input_paths;
+  typed_lisp::compile_options options;
 
-  typed_lisp::lisp_parser parser(test_program);
+  int first_arg = 1;
 
-  try {
-    std::shared_ptr<typed_lisp::node> ast = parser.parse();
-    auto visitor = std::make_shared<typed_lisp::type_visitor>(parser);
+  if (argc > 1 && std::string(argv[1]) == "run") {
+    options.run = true;
+    first_arg = 2;
+  }
 
-    /*@todo:fix*/ typed_lisp::register_builtins(visitor->global_scope);
+  for (int i = first_arg; i < argc; ++i) {
+    std::string arg = argv[i];
 
-    ast->accept(visitor.get());
+    if (arg == "--stats") {
+      options.print_stats = true;
+    } else if (arg == "--stats-json") {
+      if (i + 1 >= argc) {
+        std::cerr << "error: --stats-json expects a file path" << std::endl;
+        return 1;
+      }
 
-    const auto& errors = visitor->get_errors();
+      options.stats_path = argv[++i];
+    } else if (arg == "--dump-ir") {
+      options.dump_ir = true;
+    } else if (arg == "-c") {
+      options.emit = typed_lisp::emit_kind::object;
+    } else if (arg == "-S") {
+      options.emit = typed_lisp::emit_kind::assembly;
+    } else if (arg == "--emit-bitcode") {
+      options.emit = typed_lisp::emit_kind::bitcode;
+    } else if (arg.rfind("-j", 0) == 0) {
+      std::string count = arg.substr(2);
+      size_t used = 0;
+      int jobs = 0;
+
+      try {
+        jobs = std::stoi(count, &used);
+      } catch (const std::exception&) {
+      }
 
-    if (errors.empty()) {
-      std::cout << "no type errors found!\n";
-    } else {
-      for (const auto& error : errors) {
-        std::cout << error << "\n";
+      if (used != count.size() || jobs < 1) {
+        std::cerr << "error: -j expects a positive number of jobs, got: "
+                  << arg << std::endl;
+        return 1;
+      }
+
+      options.jobs = jobs;
+    } else if (arg.rfind("-mcpu=", 0) == 0) {
+      options.target_cpu = arg.substr(6);
+    } else if (arg == "--fast-math") {
+      options.fast_math = true;
+    } else if (arg == "--time-passes") {
+      options.time_passes = true;
+    } else if (arg == "-O0") {
+      options.opt_level = llvm::OptimizationLevel::O0;
+    } else if (arg == "-O1") {
+      options.opt_level = llvm::OptimizationLevel::O1;
+    } else if (arg == "-O2") {
+      options.opt_level = llvm::OptimizationLevel::O2;
+    } else if (arg == "-O3") {
+      options.opt_level = llvm::OptimizationLevel::O3;
+    } else if (arg == "-Os") {
+      options.opt_level = llvm::OptimizationLevel::Os;
+    } else if (arg == "-Oz") {
+      options.opt_level = llvm::OptimizationLevel::Oz;
+    } else if (arg == "-o") {
+      if (i + 1 >= argc) {
+        std::cerr << "error: -o expects a file path" << std::endl;
+        return 1;
       }
+
+      options.output_path = argv[++i];
+    } else {
+      input_paths.push_back(arg);
     }
+  }
 
-  } catch (const std::exception& e) {
-    std::cerr << "error: " << e.what() << std::endl;
+  if (input_paths.empty()) {
+    input_paths.push_back("tests/valid-def-expr.lsp");
+  }
+
+  if (options.run && input_paths.size() != 1) {
+    std::cerr << "error: run expects a single input file" << std::endl;
+    return 1;
+  }
+
+  // the JIT compiles functions lazily on first call, there is nothing to
+  // split ahead of time
+  if (options.run && options.jobs > 1) {
+    std::cerr << "error: -j cannot be used with run" << std::endl;
+    return 1;
+  }
+
+  // inputs are compiled concurrently, they cannot all write the same file
+  if (!options.output_path.empty() && input_paths.size() != 1) {
+    std::cerr << "error: -o expects a single input file" << std::endl;
     return 1;
   }
 
+  // every input gets its own compiler context, so they are compiled
+  // concurrently and reported in the order they were given
+
+  std::vector<typed_lisp::compile_result> results(input_paths.size());
+
+  if (input_paths.size() == 1) {
+    results[0] = typed_lisp::compile_file(input_paths[0], options);
+  } else {
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < input_paths.size(); ++i) {
+      workers.emplace_back([&, i] {
+        results[i] = typed_lisp::compile_file(input_paths[i], options);
+      });
+    }
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  int status = 0;
+
+  for (const auto& result : results) {
+    std::cout << result.output;
+    std::cerr << result.diagnostics;
+    status = std::max(status, result.status);
+  }
+
+  if (!options.stats_path.empty()) {
+    std::ofstream stats_file(options.stats_path);
+
+    if (!stats_file) {
+      std::cerr << "error: could not open file: " << options.stats_path
+                << std::endl;
+      return 1;
+    }
+
+    if (results.size() == 1) {
+      stats_file << results[0].stats_json;
+    } else {
+      stats_file << "[\n";
+
+      for (size_t i = 0; i < results.size(); ++i) {
+        stats_file << (i ? ",\n" : "") << results[i].stats_json;
+      }
+
+      stats_file << "]\n";
+    }
+  }
+
+  return status;
+
   // try {
   //   std::shared_ptr<typed_lisp::node> ast = parser.parse();
   //   auto visitor = std::make_shared<typed_lisp::codegen_visitor>();
@@ -1737,3 +6138,4 @@ int main() {
   //   return 1;
   // }
 }
+#endif  // TYPED_LISP_NO_MAIN
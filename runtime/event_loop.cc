@@ -0,0 +1,143 @@
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <unordered_map>
+
+namespace typed_lisp::runtime {
+
+// llvm's switch lowering starts every coroutine frame with its resume and
+// destroy functions, and clears the resume function at the final suspend
+// point
+
+struct coroutine_frame {
+  void (*resume)(void*);
+  void (*destroy)(void*);
+};
+
+bool is_done(void* handle) {
+  return static_cast<coroutine_frame*>(handle)->resume == nullptr;
+}
+
+void resume(void* handle) {
+  static_cast<coroutine_frame*>(handle)->resume(handle);
+}
+
+// ready coroutines run first, the loop only blocks in epoll_wait when there
+// is nothing to run. timers are timerfds registered with epoll
+
+class event_loop {
+  // clang-format off
+
+  int                             epoll_fd;
+  std::deque<void*>               ready;
+  std::unordered_map<int, void*>  timers;
+
+  // clang-format on
+
+  void wait_for_timers() {
+    epoll_event events[64];
+    int count = epoll_wait(epoll_fd, events, 64, -1);
+
+    if (count < 0 && errno != EINTR) {
+      std::perror("epoll_wait");
+      std::abort();
+    }
+
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      uint64_t expirations = 0;
+
+      if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        std::perror("read");
+      }
+
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+
+      ready.push_back(timers[fd]);
+      timers.erase(fd);
+    }
+  }
+
+ public:
+  event_loop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epoll_fd < 0) {
+      std::perror("epoll_create1");
+      std::abort();
+    }
+  }
+
+  ~event_loop() {
+    for (auto& [fd, handle] : timers) close(fd);
+    close(epoll_fd);
+  }
+
+  static event_loop& current() {
+    thread_local event_loop loop;
+    return loop;
+  }
+
+  void schedule(void* handle) { ready.push_back(handle); }
+
+  void sleep(void* handle, int32_t ms) {
+    if (ms <= 0) {
+      schedule(handle);
+      return;
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0) {
+      std::perror("timerfd_create");
+      std::abort();
+    }
+
+    itimerspec spec{};
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = long(ms % 1000) * 1000000;
+    timerfd_settime(fd, 0, &spec, nullptr);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+    timers[fd] = handle;
+  }
+
+  void run(void* handle) {
+    while (!is_done(handle)) {
+      if (!ready.empty()) {
+        void* next = ready.front();
+        ready.pop_front();
+        resume(next);
+      } else if (!timers.empty()) {
+        wait_for_timers();
+      } else {
+        std::fprintf(stderr, "error: awaited coroutine can never finish\n");
+        std::abort();
+      }
+    }
+  }
+};
+
+}  // namespace typed_lisp::runtime
+
+extern "C" void tl_loop_ready(void* handle) {
+  if (handle) typed_lisp::runtime::event_loop::current().schedule(handle);
+}
+
+extern "C" void tl_loop_sleep(void* handle, int32_t ms) {
+  typed_lisp::runtime::event_loop::current().sleep(handle, ms);
+}
+
+extern "C" void tl_loop_run(void* handle) {
+  typed_lisp::runtime::event_loop::current().run(handle);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// a single-threaded event loop for async defs. every thread has its own
+// loop, coroutines are passed around by their llvm coroutine handle
+
+extern "C" {
+
+// resumes the coroutine on a later turn of the loop, null is ignored
+void tl_loop_ready(void* handle);
+
+// resumes the coroutine once at least `ms` milliseconds have passed
+void tl_loop_sleep(void* handle, int32_t ms);
+
+// runs the loop until the coroutine has reached its final suspend point
+void tl_loop_run(void* handle);
+}
@@ -0,0 +1,204 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace typed_lisp::runtime {
+
+// one call to tl_parallel_for, finished when every chunk has run
+
+struct loop {
+  tl_loop_body body;
+  void* env;
+  std::atomic<int64_t> remaining;
+};
+
+struct chunk {
+  loop* owner;
+  int32_t lo;
+  int32_t hi;
+};
+
+// every worker owns a deque, it pops its own chunks from the back while idle
+// workers steal from the front
+
+class chunk_deque {
+  std::mutex mutex;
+  std::deque<chunk> chunks;
+
+ public:
+  void push(const chunk& c) {
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks.push_back(c);
+  }
+
+  bool pop(chunk& c) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (chunks.empty()) return false;
+
+    c = chunks.back();
+    chunks.pop_back();
+    return true;
+  }
+
+  bool steal(chunk& c) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (chunks.empty()) return false;
+
+    c = chunks.front();
+    chunks.pop_front();
+    return true;
+  }
+};
+
+// threads that are not pool workers, e.g. main, use deque 0
+
+thread_local size_t worker_index = 0;
+
+class thread_pool {
+  // clang-format off
+
+  std::vector<std::unique_ptr<chunk_deque>> deques;
+  std::vector<std::thread>                  threads;
+  std::mutex                                sleep_mutex;
+  std::condition_variable                   wake;
+  std::atomic<int64_t>                      queued{0};
+  bool                                      stopping = false;
+
+  // clang-format on
+
+  void work(size_t index) {
+    worker_index = index;
+
+    while (true) {
+      chunk c;
+
+      if (take(index, c)) {
+        run(c);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+
+      if (stopping) return;
+    }
+  }
+
+ public:
+  // TL_NUM_THREADS overrides the number of workers, including the caller
+  thread_pool() {
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+
+    if (const char* env = std::getenv("TL_NUM_THREADS")) {
+      workers = std::max(1, std::atoi(env));
+    }
+
+    for (size_t i = 0; i < workers; ++i) {
+      deques.push_back(std::make_unique<chunk_deque>());
+    }
+
+    for (size_t i = 1; i < workers; ++i) {
+      threads.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (auto& thread : threads) thread.join();
+  }
+
+  static thread_pool& instance() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  size_t size() const { return deques.size(); }
+
+  void push(size_t index, const chunk& c) {
+    deques[index % deques.size()]->push(c);
+    queued.fetch_add(1);
+  }
+
+  void notify() {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wake.notify_all();
+  }
+
+  // the worker's own chunks first, then the other deques in turn
+  bool take(size_t index, chunk& c) {
+    bool found = deques[index]->pop(c);
+
+    for (size_t i = 1; !found && i < deques.size(); ++i) {
+      found = deques[(index + i) % deques.size()]->steal(c);
+    }
+
+    if (found) queued.fetch_sub(1);
+
+    return found;
+  }
+
+  static void run(const chunk& c) {
+    c.owner->body(c.owner->env, c.lo, c.hi);
+    c.owner->remaining.fetch_sub(1, std::memory_order_release);
+  }
+};
+
+}  // namespace typed_lisp::runtime
+
+// the range is cut into chunks of `grain` iterations which are dealt out over
+// the workers' deques. the caller runs chunks as well, so a parallel-for
+// nested in a loop body makes progress without blocking a worker
+
+extern "C" void tl_parallel_for(int32_t begin, int32_t end, int32_t grain,
+                                tl_loop_body body, void* env) {
+  using namespace typed_lisp::runtime;
+
+  if (end <= begin) return;
+
+  auto& pool = thread_pool::instance();
+  int64_t count = int64_t(end) - begin;
+
+  if (grain <= 0) {
+    grain = int32_t(std::max<int64_t>(1, count / int64_t(pool.size() * 8)));
+  }
+
+  if (count <= grain || pool.size() == 1) {
+    body(env, begin, end);
+    return;
+  }
+
+  loop job{body, env, {(count + grain - 1) / grain}};
+  size_t self = worker_index;
+  size_t next = self;
+
+  for (int64_t lo = begin; lo < end; lo += grain) {
+    int32_t hi = int32_t(std::min<int64_t>(lo + grain, end));
+    pool.push(next++, chunk{&job, int32_t(lo), hi});
+  }
+
+  pool.notify();
+
+  while (job.remaining.load(std::memory_order_acquire) > 0) {
+    chunk c;
+
+    if (pool.take(self, c)) {
+      thread_pool::run(c);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// runtime support for parallel-for and parallel-map. generated code outlines
+// the loop body into `body`, which runs the iterations [lo, hi) against the
+// captured variables in `env`. returns once every iteration has finished
+
+extern "C" {
+
+typedef void (*tl_loop_body)(void* env, int32_t lo, int32_t hi);
+
+// grain is the number of iterations per chunk, 0 picks one from the range
+// and the number of workers
+void tl_parallel_for(int32_t begin, int32_t end, int32_t grain,
+                     tl_loop_body body, void* env);
+}
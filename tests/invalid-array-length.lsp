@@ -0,0 +1,3 @@
+; a T[N] binding of an array with a literal length is checked statically
+(let xs : int[3] (make-array 5 0))
+(array-len xs)
@@ -0,0 +1,3 @@
+; array lengths are i32 at run time, so a fixed size must fit in one
+(let xs : int[4294967297] (make-array 1 0))
+(array-len xs)
@@ -0,0 +1,5 @@
+; defs are plain functions, a nested def cannot read its parent's variables
+(def scale : int (x : int)
+  (def by : int (y : int) (* x y))
+  (by 3))
+(scale 2)
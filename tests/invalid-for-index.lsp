@@ -0,0 +1,3 @@
+; the loop index is not visible after the loop
+(for i : int 0 3 0)
+i
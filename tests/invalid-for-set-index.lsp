@@ -0,0 +1,8 @@
+; the loop index is the induction variable, it cannot be assigned
+(def s : int (n : int)
+  (let count : int 0)
+  (for i : int 0 n
+    (set i (+ i 100))
+    (set count (+ count 1)))
+  count)
+(s 5)
@@ -0,0 +1,4 @@
+; a let inside a branch is only visible in that branch
+(let c : bool true)
+(if c (let y : int 1) (let y : int 2))
+y
@@ -0,0 +1,9 @@
+; a parallel body in a nested def cannot read the enclosing def's variables
+(def fill : int (n : int)
+  (def run : int (k : int)
+    (let xs : int[] (make-array 10 0))
+    (parallel-for i : int 0 10
+      (array-set xs i n))
+    (array-get xs k))
+  (run 1))
+(fill 3)
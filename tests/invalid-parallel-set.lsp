@@ -0,0 +1,5 @@
+; iterations run concurrently, so a captured variable cannot be assigned
+(let total : int 0)
+(parallel-for i : int 0 100
+  (set total (+ total i)))
+total
@@ -0,0 +1,4 @@
+; a shuffle gives a vector with a lane per index, which needs at least two.
+; The only error is the shuffle's, the enclosing lane still type-checks
+(let v : vec4i (splat vec4i 1))
+(lane (shuffle v v 1) 0)
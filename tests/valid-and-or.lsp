@@ -0,0 +1,6 @@
+(def quotient-is-zero : bool (a : int b : int)
+  (and (!= b 0) (= (/ a b) 0)))
+
+(if (quotient-is-zero 1 0)
+  1
+  (if (or (quotient-is-zero 1 2) (quotient-is-zero 5 0)) 42 3))
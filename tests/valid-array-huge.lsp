@@ -0,0 +1,4 @@
+; 2^31 - 1 elements of 128 bytes do not fit in memory, so the allocation
+; fails and the program traps instead of filling a short buffer
+(let xs : vec16i64[] (make-array 2147483647 (splat vec16i64 1i64)))
+(cast int (lane (array-get xs 2147483646) 0))
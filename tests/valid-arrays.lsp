@@ -0,0 +1,15 @@
+(def sum : int (xs : int[])
+  (let total : int 0)
+  (for i : int 0 (array-len xs)
+    (set total (+ total (array-get xs i))))
+  total)
+
+(let squares : int[8] (make-array 8 0))
+
+(for i : int 0 8
+  (array-set squares i (* i i)))
+
+; a zero-length array is fixed too, only T[] is left to run time
+(let none : int[0] (make-array 0 0))
+
+(+ (sum none) (- (sum squares) (array-get squares 7)))
@@ -0,0 +1,12 @@
+(def fetch : async<int> (id : int ms : int)
+  (sleep ms)
+  (* id 10))
+
+(def both : async<int> ()
+  (let a : async<int> (fetch 1 30))
+  (let b : async<int> (fetch 3 10))
+  (+ (await a) (await b)))
+
+(def ready : async<int> (x : int) (+ x 1))
+
+(+ (await (both)) (await (ready 1)))
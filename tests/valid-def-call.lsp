@@ -0,0 +1,9 @@
+(def add : int (x : int y : int)
+  (+ x y))
+
+(def fact : int (n : int)
+  (if (< n 2)
+    1
+    (* n (fact (- n 1)))))
+
+(add (fact 5) 2)
@@ -0,0 +1,15 @@
+; top-level lets that are not constants are module globals, so defs can
+; read and assign them
+(let base : int (+ (array-len (make-array 3 0)) 2))
+(let calls : int 0)
+
+(def offset : int (x : int)
+  (set calls (+ calls 1))
+  (+ x base))
+
+(let base : int 100)
+
+(def shifted : int (x : int)
+  (+ (offset x) base))
+
+(- (shifted 1) calls)
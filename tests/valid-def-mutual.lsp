@@ -0,0 +1,13 @@
+; top-level defs can call the ones declared after them, the calls between
+; is-even and is-odd are tail calls so ten million of them need no stack
+(def is-even : bool (n : int)
+  (if (= n 0)
+    true
+    (is-odd (- n 1))))
+
+(def is-odd : bool (n : int)
+  (if (= n 0)
+    false
+    (is-even (- n 1))))
+
+(if (is-even 10000001) 0 42)
@@ -0,0 +1,11 @@
+(def id : 'a (x : 'a) x)
+
+(def pick : 'a (c : bool a : 'a b : 'a)
+  (if c a b))
+
+; a polymorphic def calling another one is still polymorphic
+(def twice : 'a (x : 'a) (id x))
+
+(if (twice true)
+  (pick false (twice 1) (id 42))
+  0)
@@ -0,0 +1,9 @@
+(def count : int (n : int acc : int)
+  (if (= n 0)
+    acc
+    (count (- n 1) (+ acc 1))))
+
+(def count-down : int (n : int acc : int)
+  (count n acc))
+
+(- (count-down 10000000 0) 9999958)
@@ -0,0 +1,11 @@
+(def dot : double (xs : double[] ys : double[])
+  (let sum : double 0.0)
+  (for i : int 0 (array-len xs)
+    (set sum (+ sum (* (array-get xs i) (array-get ys i)))))
+  sum)
+
+(let xs : double[] (make-array 8 1.5))
+(let ys : double[] (make-array 8 2.0))
+(let half : float (/ 1.0f 2.0f))
+
+(if (and (= (dot xs ys) 24.0) (< half 0.75f)) 42 0)
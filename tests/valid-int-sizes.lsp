@@ -0,0 +1,20 @@
+(def sum-bytes : u64 (bytes : u8[])
+  (let total : u64 0u64)
+  (for i : int 0 (array-len bytes)
+    (set total (+ total (cast u64 (array-get bytes i)))))
+  total)
+
+(let bytes : u8[] (make-array 1000 200u8))
+(let big : i64 (* 3000000000i64 2i64))
+(let wrapped : u8 (+ 250u8 10u8))
+(let steps : i64 0i64)
+
+(for j : i64 0i64 5i64
+  (set steps (+ steps j)))
+
+(if (and (= (sum-bytes bytes) 200000u64)
+         (and (> big 5000000000i64)
+              (and (< wrapped 5u8)
+                   (and (> (cast u8 -1i8) 1u8) (= steps 10i64)))))
+  (cast int (/ 420.5 10.0))
+  0)
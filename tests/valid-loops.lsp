@@ -0,0 +1,18 @@
+(let total : int 0)
+
+(for i : int 0 10
+  (set total (+ total i)))
+
+(let n : int 0)
+
+(while (< n 5)
+  (set n (+ n 1))
+  (set total (- total 1)))
+
+(def sum-to : int (limit : int)
+  (let acc : int 0)
+  (for k : int 1 (+ limit 1)
+    (set acc (+ acc k)))
+  acc)
+
+(- (+ total (sum-to 4)) 8)
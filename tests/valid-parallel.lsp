@@ -0,0 +1,23 @@
+(def square : int (x : int) (* x x))
+
+(let xs : int[] (make-array 1000 3))
+(let offset : int 2)
+(let scale : int (+ (array-len xs) 1))
+
+; top-level lets that are not constants are globals, bodies read them in place
+(def fill : int (k : int)
+  (let ys : int[] (make-array 10 0))
+  (parallel-for i : int 0 10
+    (array-set ys i scale))
+  (array-get ys k))
+
+(parallel-for i : int 0 (array-len xs)
+  (array-set xs i (+ (array-get xs i) offset)))
+
+(let squares : int[] (parallel-map square xs))
+
+(let total : int 0)
+(for i : int 0 (array-len squares)
+  (set total (+ total (array-get squares i))))
+
+(- (/ total 1000) (- (fill 3) 1018))
@@ -0,0 +1,7 @@
+(def bump : int (n : int)
+  (set n (+ n 1))
+  (let k : int (* n 2))
+  (+ k n))
+(let a : int 3)
+(set a (bump a))
+a
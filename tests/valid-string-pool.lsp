@@ -0,0 +1,6 @@
+(let greeting : string "hello")
+(printf "hello")
+(printf greeting)
+(printf "world")
+(printf "hello")
+0
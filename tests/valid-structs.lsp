@@ -0,0 +1,17 @@
+(struct point (x : int y : int))
+(struct particle soa (pos : int vel : int))
+
+(def manhattan : int (p : point)
+  (+ (field p x) (field p y)))
+
+(let ps : particle[] (make-array 4 (new particle 1 2)))
+
+(for i : int 0 (array-len ps)
+  (array-set ps i (with (array-get ps i) pos (* i 10))))
+
+(let total : int 0)
+
+(for i : int 0 (array-len ps)
+  (set total (+ total (field (array-get ps i) pos))))
+
+(- (+ total (manhattan (new point 3 4))) 25)
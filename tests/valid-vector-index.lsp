@@ -0,0 +1,13 @@
+; load-vec and store-vec at indices only known at run time, up to the last
+; start that still fits every lane
+(def window : int (xs : int[] i : int)
+  (reduce-add (load-vec vec4i xs i)))
+
+(def put : int (xs : int[] i : int)
+  (store-vec xs i (splat vec4i 2))
+  0)
+
+(let xs : int[] (make-array 10 1))
+(put xs 6)
+
+(+ (window xs 0) (+ (window xs 3) (+ 1 (* 4 (window xs 6)))))
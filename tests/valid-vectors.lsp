@@ -0,0 +1,16 @@
+(def dot : float (xs : float[] ys : float[])
+  (let acc : vec4f (splat vec4f 0.0f))
+  (for k : int 0 (/ (array-len xs) 4)
+    (set acc (+ acc (* (load-vec vec4f xs (* k 4))
+                       (load-vec vec4f ys (* k 4))))))
+  (reduce-add acc))
+
+(let xs : float[] (make-array 16 1.5f))
+(let ys : float[] (make-array 16 2.0f))
+
+(let v : vec4i (with-lane (splat vec4i 1) 3 7))
+(let r : vec4i (shuffle v (splat vec4i 0) 3 2 1 4))
+(store-vec xs 0 (splat vec4f 3.0f))
+
+(+ (cast int (dot xs ys))
+   (+ (reduce-max r) (+ (reduce-add r) (cast int (lane (load-vec vec2f xs 2) 1)))))